@@ -0,0 +1,157 @@
+/***************************************************************************//**
+ * Chat history: a bounded ring of chat lines, see chat_history.h.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chat_history.h"
+
+/*
+  Allocate an empty history within the given number of bytes, at least
+  CH_BYTES_PER_LINE, returning false on failure.
+ */
+bool ch_init(chat_history *hist, size_t bytes)
+{
+  if (bytes < CH_BYTES_PER_LINE) {
+    bytes = CH_BYTES_PER_LINE;
+  }
+  hist->max_lines = bytes / CH_BYTES_PER_LINE;
+  hist->size = bytes - hist->max_lines * sizeof(chat_line);
+  hist->lines = malloc(hist->max_lines * sizeof(chat_line));
+  hist->text = malloc(hist->size);
+  hist->oldest = 0;
+  hist->count = 0;
+  hist->end = 0;
+
+  if (hist->lines == NULL || hist->text == NULL) {
+    ch_destroy(hist);
+    return false;
+  }
+  return true;
+}
+
+void ch_destroy(chat_history *hist)
+{
+  free(hist->lines);
+  free(hist->text);
+  hist->lines = NULL;
+  hist->text = NULL;
+}
+
+/*
+  Numbers of the oldest line held, and of the next line to be added.
+ */
+unsigned long ch_begin(const chat_history *hist)
+{
+  return hist->end - hist->count;
+}
+
+unsigned long ch_end(const chat_history *hist)
+{
+  return hist->end;
+}
+
+/*
+  Entry of the i-th line held, from the oldest.
+ */
+static chat_line *ch_entry(const chat_history *hist, size_t i)
+{
+  return &hist->lines[(hist->oldest + i) % hist->max_lines];
+}
+
+/*
+  Line number n, or NULL if it is not held (any more).  Its length is stored in
+  len, if given.
+ */
+const char *ch_line(const chat_history *hist, unsigned long n, size_t *len)
+{
+  chat_line *line;
+
+  if (n < ch_begin(hist) || n >= hist->end) {
+    return NULL;
+  }
+  line = ch_entry(hist, n - ch_begin(hist));
+  if (len) {
+    *len = line->len;
+  }
+  return hist->text + line->start;
+}
+
+/*
+  Drop the oldest line.
+ */
+static void ch_drop(chat_history *hist)
+{
+  hist->oldest = (hist->oldest + 1) % hist->max_lines;
+  hist->count--;
+}
+
+/*
+  Add a line of len characters, truncated if it is longer than the whole ring,
+  dropping as many of the oldest lines as needed to make room for it.
+ */
+void ch_add(chat_history *hist, const char *text, size_t len)
+{
+  size_t start = 0, need;
+  chat_line *line;
+
+  if (len > hist->size - 1) {
+    len = hist->size - 1;
+  }
+  need = len + 1;
+
+  if (hist->count == hist->max_lines) {
+    ch_drop(hist);
+  }
+
+  if (hist->count > 0) {
+    line = ch_entry(hist, hist->count - 1);
+    start = line->start + line->len + 1;
+    /*
+      Past the end of the newest line, the ring holds the oldest lines in order,
+      up to its end, then from its start.  If the line does not fit before the
+      end of the ring, it goes to the start, hence lines up to the end of the
+      ring are dropped first.
+     */
+    if (start + need > hist->size) {
+      while (hist->count > 0 && ch_entry(hist, 0)->start >= start) {
+        ch_drop(hist);
+      }
+      start = 0;
+    }
+    while (hist->count > 0 && ch_entry(hist, 0)->start < start + need &&
+           ch_entry(hist, 0)->start >= start) {
+      ch_drop(hist);
+    }
+  }
+
+  line = ch_entry(hist, hist->count);
+  line->start = start;
+  line->len = len;
+  memcpy(hist->text + start, text, len);
+  hist->text[start + len] = '\0';
+  hist->count++;
+  hist->end++;
+}
+
+/*
+  Find the newest line before line number before which contains needle,
+  storing its number in found.  Returns false if there is none.
+ */
+bool ch_search(const chat_history *hist, const char *needle,
+               unsigned long before, unsigned long *found)
+{
+  unsigned long n;
+
+  if (before > hist->end) {
+    before = hist->end;
+  }
+  for (n = before; n > ch_begin(hist); n--) {
+    if (strstr(ch_line(hist, n - 1, NULL), needle) != NULL) {
+      *found = n - 1;
+      return true;
+    }
+  }
+  return false;
+}
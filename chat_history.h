@@ -0,0 +1,54 @@
+/***************************************************************************//**
+ * Chat history: the lines shown in the live chat, kept in bounded memory for
+ * scrollback and search.
+ *
+ * Lines are stored back to back, each null terminated, in a ring of bytes, and
+ * located through a ring of line entries.  Both are allocated once, within a
+ * budget given to ch_init; once either is full, the oldest lines are dropped to
+ * make room for new ones.  A line never wraps around the end of the ring, hence
+ * it may always be read in place, as a C string.
+ *
+ * Lines are numbered from 0 in the order they were added, and keep their
+ * number as later lines are added; the lines held are those numbered from
+ * ch_begin up to, but excluding, ch_end.
+ ******************************************************************************/
+
+#ifndef CHAT_HISTORY_H
+#define CHAT_HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+  Share of the memory budget set aside for each line entry; history made up of
+  shorter lines keeps fewer of them than the budget would allow.
+ */
+#define CH_BYTES_PER_LINE 64
+
+typedef struct {
+  size_t start;
+  size_t len;  // not counting the terminating null
+} chat_line;
+
+typedef struct {
+  char *text;
+  size_t size;
+  chat_line *lines;
+  size_t max_lines;
+  size_t oldest;  // entry of line ch_begin
+  size_t count;
+  unsigned long end;
+} chat_history;
+
+bool ch_init(chat_history *hist, size_t bytes);
+void ch_destroy(chat_history *hist);
+
+unsigned long ch_begin(const chat_history *hist);
+unsigned long ch_end(const chat_history *hist);
+const char *ch_line(const chat_history *hist, unsigned long n, size_t *len);
+
+void ch_add(chat_history *hist, const char *text, size_t len);
+bool ch_search(const chat_history *hist, const char *needle,
+               unsigned long before, unsigned long *found);
+
+#endif // CHAT_HISTORY_H
@@ -0,0 +1,164 @@
+/***************************************************************************//**
+ * Chat input: a gap buffer line editor, see chat_input.h.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chat_input.h"
+
+/*
+  Allocate the buffer of an empty line, returning false on failure.
+ */
+bool ci_init(chat_input *in)
+{
+  in->buf = malloc(CI_INITIAL_SIZE);
+  in->size = CI_INITIAL_SIZE;
+  in->gap_start = 0;
+  in->gap_end = CI_INITIAL_SIZE;
+  in->first = 0;
+  return in->buf != NULL;
+}
+
+void ci_destroy(chat_input *in)
+{
+  free(in->buf);
+  in->buf = NULL;
+}
+
+/*
+  Number of characters in the line, and position of the cursor.
+ */
+size_t ci_length(const chat_input *in)
+{
+  return in->size - (in->gap_end - in->gap_start);
+}
+
+size_t ci_cursor(const chat_input *in)
+{
+  return in->gap_start;
+}
+
+/*
+  Character i of the line, skipping over the gap.
+ */
+char ci_at(const chat_input *in, size_t i)
+{
+  return in->buf[i < in->gap_start ? i : i + (in->gap_end - in->gap_start)];
+}
+
+/*
+  Double the buffer, keeping the characters after the gap at its end.
+ */
+static bool ci_grow(chat_input *in)
+{
+  size_t size = 2 * in->size, tail = in->size - in->gap_end;
+  char *buf = realloc(in->buf, size);
+
+  if (buf == NULL) {
+    return false;
+  }
+  memmove(buf + size - tail, buf + in->gap_end, tail);
+  in->buf = buf;
+  in->gap_end = size - tail;
+  in->size = size;
+  return true;
+}
+
+/*
+  Insert a character at the cursor, returning false if the line could not grow.
+ */
+bool ci_insert(chat_input *in, char c)
+{
+  if (in->gap_end - in->gap_start == 1 && !ci_grow(in)) {
+    return false;
+  }
+  in->buf[in->gap_start++] = c;
+  return true;
+}
+
+/*
+  Delete the character before, or after, the cursor, returning false if there
+  is none.
+ */
+bool ci_backspace(chat_input *in)
+{
+  if (in->gap_start == 0) {
+    return false;
+  }
+  in->gap_start--;
+  return true;
+}
+
+bool ci_delete(chat_input *in)
+{
+  if (in->gap_end == in->size) {
+    return false;
+  }
+  in->gap_end++;
+  return true;
+}
+
+/*
+  Move the cursor to the given position, clamped to the end of the line.
+ */
+void ci_move(chat_input *in, size_t cursor)
+{
+  size_t n;
+
+  if (cursor > ci_length(in)) {
+    cursor = ci_length(in);
+  }
+  if (cursor < in->gap_start) {
+    n = in->gap_start - cursor;
+    memmove(in->buf + in->gap_end - n, in->buf + cursor, n);
+    in->gap_start -= n;
+    in->gap_end -= n;
+  } else {
+    n = cursor - in->gap_start;
+    memmove(in->buf + in->gap_start, in->buf + in->gap_end, n);
+    in->gap_start += n;
+    in->gap_end += n;
+  }
+}
+
+/*
+  Empty the line, keeping its buffer.
+ */
+void ci_clear(chat_input *in)
+{
+  in->gap_start = 0;
+  in->gap_end = in->size;
+  in->first = 0;
+}
+
+/*
+  The line as a null terminated string, valid until the line is next edited.
+  The cursor moves to the end of the line, closing up the characters into one
+  run.
+ */
+const char *ci_text(chat_input *in)
+{
+  ci_move(in, ci_length(in));
+  in->buf[in->gap_start] = '\0';
+  return in->buf;
+}
+
+/*
+  Scroll the line so that the cursor is visible in a window width characters
+  wide, returning the first character to show.  The line only scrolls when the
+  cursor leaves the window, and by as little as needed; the last column is kept
+  for the cursor past the end of the line.
+ */
+size_t ci_scroll(chat_input *in, size_t width)
+{
+  if (width == 0) {
+    return in->first;
+  }
+  if (in->gap_start < in->first) {
+    in->first = in->gap_start;
+  } else if (in->gap_start >= in->first + width) {
+    in->first = in->gap_start - width + 1;
+  }
+  return in->first;
+}
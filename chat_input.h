@@ -0,0 +1,59 @@
+/***************************************************************************//**
+ * Chat input: the line editor behind the chat box.
+ *
+ * The line is kept in a gap buffer, i.e. one allocation holding the characters
+ * before the cursor at its start and those after the cursor at its end, with
+ * the free space (the gap) in between.  Typing and deleting at the cursor only
+ * move the ends of the gap, and moving the cursor only moves the characters it
+ * passes over.  The buffer is allocated once, and grows (doubling) only when a
+ * line outgrows it, hence lines are not limited in length and editing does not
+ * allocate.
+ *
+ * The editor also keeps the horizontal scroll of the line, for lines longer
+ * than the window showing them, see ci_scroll.
+ ******************************************************************************/
+
+#ifndef CHAT_INPUT_H
+#define CHAT_INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+  Initial size of the buffer.
+ */
+#define CI_INITIAL_SIZE 256
+
+typedef struct {
+  char *buf;
+  size_t size;
+  /*
+    The gap is buf[gap_start .. gap_end); the cursor is at gap_start.  There is
+    always room for at least one character in the gap, for the terminating null
+    written by ci_text.
+   */
+  size_t gap_start;
+  size_t gap_end;
+  /*
+    First character shown, set by ci_scroll.
+   */
+  size_t first;
+} chat_input;
+
+bool ci_init(chat_input *in);
+void ci_destroy(chat_input *in);
+
+size_t ci_length(const chat_input *in);
+size_t ci_cursor(const chat_input *in);
+char ci_at(const chat_input *in, size_t i);
+
+bool ci_insert(chat_input *in, char c);
+bool ci_backspace(chat_input *in);
+bool ci_delete(chat_input *in);
+void ci_move(chat_input *in, size_t cursor);
+void ci_clear(chat_input *in);
+
+const char *ci_text(chat_input *in);
+size_t ci_scroll(chat_input *in, size_t width);
+
+#endif // CHAT_INPUT_H
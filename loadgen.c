@@ -0,0 +1,366 @@
+/***************************************************************************//**
+ * Load generator: runs many sessions of the front-end in headless mode, built
+ * against the mock client library (see mock/client_server.h), and drives them
+ * from a pool of worker threads, each session playing random moves whenever in
+ * a game. Reports how long chat messages took from the mock server to the
+ * output of the front-end, how regularly game frames came, and how many
+ * sessions ran to the end.
+ *
+ * The mock server of every session plays the script given with -s, if any.
+ * Any arguments after the front-end are passed on to it.
+ *
+ * Usage: ./tetris_loadgen [-n sessions] [-t threads] [-d seconds] [-r moves_per_sec] [-s script]
+ *                         front_end [front_end_args...]
+ ******************************************************************************/
+
+#define _GNU_SOURCE // for pipe2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "metrics.h"
+
+// Defaults of the options
+#define LG_SESSIONS 16
+#define LG_THREADS 4
+#define LG_SECONDS 10
+#define LG_MOVES_PER_SEC 10
+
+// Longest line read from a front-end, as the longest frame of the largest board; longer lines are dropped
+#define LG_LINE_MAX 4096
+
+// Longest a worker waits for output before checking whether moves are due or the run is over
+#define LG_POLL_MS 100
+
+typedef struct{
+    pid_t pid;
+    int in_fd, out_fd; // the front-end's stdin and stdout
+    char line[LG_LINE_MAX];
+    size_t len;
+    int discarding; // whether the rest of a line too long to be kept is being skipped, up to its end
+    int in_game, closed;
+    long long next_move_nsec, last_frame_nsec;
+    unsigned int seed;
+} lg_session;
+
+// A worker drives every session whose index is its own modulo the number of workers, and keeps its own figures
+typedef struct{
+    int id;
+    pthread_t thread;
+    metric_hist chat_latency, frame_gap;
+    long chat_lines, frames, games_started, games_ended, closed_early;
+} lg_worker;
+
+static lg_session* sessions;
+static int n_sessions = LG_SESSIONS, n_threads = LG_THREADS, moves_per_sec = LG_MOVES_PER_SEC;
+static long long end_nsec;
+
+static long long now_nsec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Starts a session: the front-end, with argv, connected to the session through a pipe on its stdin and one on its
+ * stdout. Returns 0 on failure.
+ */
+static int start_session(lg_session* s, char* argv[]){
+    int in[2], out[2];
+
+    memset(s, 0, sizeof(*s));
+    if(pipe2(in, O_CLOEXEC) < 0){
+        return 0;
+    }
+    if(pipe2(out, O_CLOEXEC) < 0){
+        close(in[0]);
+        close(in[1]);
+        return 0;
+    }
+
+    s->pid = fork();
+    if(s->pid == 0){
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    close(in[0]);
+    close(out[1]);
+    if(s->pid < 0){
+        close(in[1]);
+        close(out[0]);
+        return 0;
+    }
+
+    s->in_fd = in[1];
+    s->out_fd = out[0];
+    s->seed = (unsigned int) s->pid;
+    fcntl(s->in_fd, F_SETFL, O_NONBLOCK); // moves are dropped, rather than waited on, if the front-end falls behind
+    return 1;
+}
+
+// Handles a line of output of a session's front-end, see the README for its format
+static void handle_line(lg_worker* w, lg_session* s, const char* line, long long now){
+    long long sent_nsec;
+
+    switch(line[0]){
+        case 'C':
+            w->chat_lines++;
+            if(sscanf(line, "C [%lld]", &sent_nsec) == 1){ // sent by the mock server
+                mt_record(&w->chat_latency, now - sent_nsec);
+            }
+            break;
+        case 'S':
+            w->games_started++;
+            s->in_game = 1;
+            s->next_move_nsec = now;
+            s->last_frame_nsec = 0;
+            break;
+        case 'F':
+            w->frames++;
+            if(s->last_frame_nsec > 0){
+                mt_record(&w->frame_gap, now - s->last_frame_nsec);
+            }
+            s->last_frame_nsec = now;
+            break;
+        case 'E':
+            w->games_ended++;
+            s->in_game = 0;
+            break;
+    }
+}
+
+// Reads the pending output of a session, and handles every complete line of it; the session is closed at its end
+static void read_session(lg_worker* w, lg_session* s, long long now){
+    ssize_t n = read(s->out_fd, s->line + s->len, sizeof(s->line) - s->len);
+
+    if(n <= 0){
+        if(n < 0 && (errno == EINTR || errno == EAGAIN)){
+            return;
+        }
+        s->closed = 1;
+        w->closed_early++;
+        return;
+    }
+
+    size_t end = s->len + n, start = 0;
+    for(size_t i = s->len; i < end; i++){
+        if(s->line[i] == '\n'){
+            s->line[i] = '\0';
+            if(!s->discarding){
+                handle_line(w, s, s->line + start, now);
+            }
+            s->discarding = 0;
+            start = i + 1;
+        }
+    }
+
+    s->len = end - start;
+    if(s->len == sizeof(s->line) || (s->discarding && s->len > 0)){
+        // no end of line in sight: drop the line, along with whatever comes of it up to its end, rather than handle its
+        // tail as a line of its own
+        s->len = 0;
+        s->discarding = 1;
+    }
+    memmove(s->line, s->line + start, s->len);
+}
+
+// Sends a random move to a session in game, if one is due; after a stall, the moves missed are skipped
+static void move_session(lg_session* s, long long now){
+    static const char moves[] = "lrcwd";
+    char cmd[4] = {'m', ' ', ' ', '\n'};
+
+    if(!s->in_game || moves_per_sec <= 0 || now < s->next_move_nsec){
+        return;
+    }
+
+    cmd[2] = moves[rand_r(&s->seed) % (sizeof(moves) - 1)];
+    if(write(s->in_fd, cmd, sizeof(cmd)) < 0 && errno != EAGAIN){
+        return;
+    }
+
+    s->next_move_nsec += 1000000000LL / moves_per_sec;
+    if(s->next_move_nsec < now){
+        s->next_move_nsec = now + 1000000000LL / moves_per_sec;
+    }
+}
+
+// Drives the sessions of a worker until the end of the run, or until all of them closed
+static void* run_worker(void* arg){
+    lg_worker* w = arg;
+    int n_own = (n_sessions - w->id + n_threads - 1) / n_threads;
+    struct pollfd* fds = calloc(n_own, sizeof(struct pollfd));
+    lg_session** own = calloc(n_own, sizeof(lg_session*));
+
+    if(fds == NULL || own == NULL){
+        fprintf(stderr, "Error while allocating memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < n_own; i++){
+        own[i] = &sessions[w->id + i * n_threads];
+    }
+
+    long long now;
+    while((now = now_nsec()) < end_nsec){
+        int n_open = 0;
+        long long wake = end_nsec;
+
+        for(int i = 0; i < n_own; i++){
+            if(own[i]->closed){
+                continue;
+            }
+
+            move_session(own[i], now);
+            if(own[i]->in_game && moves_per_sec > 0 && own[i]->next_move_nsec < wake){
+                wake = own[i]->next_move_nsec;
+            }
+
+            fds[n_open].fd = own[i]->out_fd;
+            fds[n_open].events = POLLIN;
+            n_open++;
+        }
+
+        if(n_open == 0){
+            break;
+        }
+
+        int timeout = (int) ((wake - now + 999999) / 1000000);
+        if(poll(fds, n_open, timeout < LG_POLL_MS ? timeout : LG_POLL_MS) <= 0){
+            continue;
+        }
+
+        now = now_nsec();
+        for(int i = 0, j = 0; i < n_own; i++){
+            if(own[i]->closed){
+                continue;
+            }
+            if(fds[j++].revents & (POLLIN | POLLHUP | POLLERR)){
+                read_session(w, own[i], now);
+            }
+        }
+    }
+
+    free(fds);
+    free(own);
+    return NULL;
+}
+
+static void print_hist(const char* name, metric_hist* hist){
+    mt_roll(hist);
+    printf("%s p50 %.2fms, p99 %.2fms\n", name, hist->p50 / 1e6, hist->p99 / 1e6);
+}
+
+int main(int argc, char* argv[]){
+    int opt, seconds = LG_SECONDS, bad_args = 0;
+
+    while((opt = getopt(argc, argv, "+n:t:d:r:s:")) != -1){ // stop at the front-end, whose arguments follow
+        switch(opt){
+            case 'n': n_sessions = atoi(optarg); bad_args |= n_sessions <= 0; break;
+            case 't': n_threads = atoi(optarg); bad_args |= n_threads <= 0; break;
+            case 'd': seconds = atoi(optarg); bad_args |= seconds <= 0; break;
+            case 'r': moves_per_sec = atoi(optarg); bad_args |= moves_per_sec < 0; break;
+            case 's': setenv("TETRIS_MOCK_SCRIPT", optarg, 1); break; // inherited by every front-end
+            default: bad_args = 1;
+        }
+    }
+
+    if(bad_args || optind >= argc){
+        fprintf(stderr, "Usage: %s [-n sessions] [-t threads] [-d seconds] [-r moves_per_sec] [-s script] "
+                        "front_end [front_end_args...]\n", argv[0]);
+        return 1;
+    }
+    if(n_threads > n_sessions){
+        n_threads = n_sessions;
+    }
+
+    // the front-end's arguments, then headless mode on its stdin and stdout; the address is ignored by the mock
+    int n_fe_args = argc - optind;
+    char** fe_argv = calloc(n_fe_args + 4, sizeof(char*));
+    sessions = calloc(n_sessions, sizeof(lg_session));
+    lg_worker* workers = calloc(n_threads, sizeof(lg_worker));
+    if(fe_argv == NULL || sessions == NULL || workers == NULL){
+        fprintf(stderr, "Error while allocating memory\n");
+        return 1;
+    }
+    memcpy(fe_argv, argv + optind, n_fe_args * sizeof(char*));
+    fe_argv[n_fe_args] = "-H";
+    fe_argv[n_fe_args + 1] = "-";
+    fe_argv[n_fe_args + 2] = "127.0.0.1";
+
+    // two pipes per session: raise the limit on descriptors as far as allowed
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0){
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    signal(SIGPIPE, SIG_IGN); // a front-end which exited is noticed when reading its output
+
+    for(int i = 0; i < n_sessions; i++){
+        if(!start_session(&sessions[i], fe_argv)){
+            fprintf(stderr, "Error while starting session %d: %s\n", i, strerror(errno));
+            return 1;
+        }
+    }
+
+    long long start = now_nsec();
+    end_nsec = start + seconds * 1000000000LL;
+    for(int i = 0; i < n_threads; i++){
+        workers[i].id = i;
+        if(pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0){
+            fprintf(stderr, "Error while creating worker thread\n");
+            return 1;
+        }
+    }
+
+    // combine the figures of the workers once they are done
+    lg_worker total;
+    memset(&total, 0, sizeof(total));
+    for(int i = 0; i < n_threads; i++){
+        pthread_join(workers[i].thread, NULL);
+        mt_merge(&total.chat_latency, &workers[i].chat_latency);
+        mt_merge(&total.frame_gap, &workers[i].frame_gap);
+        total.chat_lines += workers[i].chat_lines;
+        total.frames += workers[i].frames;
+        total.games_started += workers[i].games_started;
+        total.games_ended += workers[i].games_ended;
+        total.closed_early += workers[i].closed_early;
+    }
+    double elapsed = (now_nsec() - start) / 1e9;
+
+    // closing its input makes a front-end exit; then see how each did
+    int n_ok = 0;
+    for(int i = 0; i < n_sessions; i++){
+        close(sessions[i].in_fd);
+        close(sessions[i].out_fd);
+    }
+    for(int i = 0; i < n_sessions; i++){
+        int status;
+        if(waitpid(sessions[i].pid, &status, 0) == sessions[i].pid && WIFEXITED(status) && WEXITSTATUS(status) == 0){
+            n_ok++;
+        }
+    }
+
+    printf("%d sessions on %d threads, for %.1fs\n", n_sessions, n_threads, elapsed);
+    printf("chat lines: %ld (%.0f/s)\n", total.chat_lines, total.chat_lines / elapsed);
+    print_hist("chat latency from the mock server:", &total.chat_latency);
+    printf("games: %ld started, %ld ended; frames: %ld (%.0f/s)\n", total.games_started, total.games_ended,
+           total.frames, total.frames / elapsed);
+    print_hist("time between frames:", &total.frame_gap);
+    printf("sessions: %ld closed early, %d exited cleanly\n", total.closed_early, n_ok);
+
+    free(fe_argv);
+    free(sessions);
+    free(workers);
+    return n_ok == n_sessions ? 0 : 1;
+}
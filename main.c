@@ -1,8 +1,25 @@
+#define _GNU_SOURCE // for ppoll
+
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
 #include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "curses.h"
 
 #include "tetris.h"
+#include "tetris_replay.h"
+#include "tetris_search.h"
+#include "chat_input.h"
+#include "chat_history.h"
+#include "msg_inbox.h"
+#include "metrics.h"
 #include "client_server.h" // import client library header file
 
 /***************************************************************************/
@@ -11,16 +28,57 @@
 // 2 columns per cell makes the game much nicer.
 #define COLS_PER_CELL 2
 
+// Fixed timestep: simulation ticks per second (as the previous loop, one tick per ~10ms), the cap on rendered frames
+// per second, and the most ticks simulated at once to catch up after a stall
+#define TICK_RATE 100
+#define FRAME_RATE 60
+#define MAX_CATCHUP_TICKS 10
+#define TICK_NSEC (1000000000LL / TICK_RATE)
+#define FRAME_NSEC (1000000000LL / FRAME_RATE)
+
+// Default least time between two score updates sent to the server, and the size of the buffer holding the score as
+// text: the longest int in decimal, with its sign and terminating null
+#define SCORE_INTERVAL_MS 250
+#define SCORE_MSG_SIZE 12
+
+// Default memory budget of the chat history, in KiB, and the chat box command searching it
+#define CHAT_HISTORY_KIB 256
+#define CHAT_SEARCH "/search"
+
+// Most server messages handled per pass of the main loop, and the most time spent handling them, before the game and
+// the keyboard get their turn
+#define MAX_MSGS_PER_PASS 256
+#define MSG_BUDGET_NSEC 2000000LL
+
+// Default delayed auto-shift and auto-repeat rate, in ms, and the longest delay before a terminal starts repeating a held
+// key and between its repeats, see press_shift
+#define DAS_MS 170
+#define ARR_MS 50
+#define KEY_DELAY_NSEC 700000000LL
+#define KEY_REPEAT_NSEC 100000000LL
+
+// Longest command line read in headless mode; longer lines are dropped
+#define HEADLESS_LINE_MAX 4096
+
+// Least time between two blocks placed by the autoplayer, see autoplay, and the most blocks it may look ahead: a search
+// of 4 blocks takes tens of seconds per block, by which time the block has long landed by itself
+#define AUTOPLAY_NSEC 250000000LL
+#define AUTOPLAY_MAX_DEPTH 3
+
+// Period over which the figures of the debug window and the metrics file are taken
+#define METRICS_PERIOD_NSEC 1000000000LL
+
 // Macro to print a cell of a specific type to a window.
 #define ADD_BLOCK(w,x) waddch((w),' '|A_REVERSE|COLOR_PAIR(x)); waddch((w),' '|A_REVERSE|COLOR_PAIR(x))
 #define ADD_EMPTY(w) waddch((w), ' '); waddch((w), ' ')
 
 // TETRIS FUNC DEFNS (see Stephen Brennan's implementation at https://github.com/brenns10/tetris)
 
-void sleep_milli(int milliseconds);
-void display_board(WINDOW *w, tetris_game *obj);
-void display_piece(WINDOW *w, tetris_block block);
-void display_score(WINDOW *w, tetris_game *tg);
+long long now_nsec(void);
+void wait_for_events(long long deadline);
+int display_board(WINDOW *w, tetris_game *obj);
+int display_piece(WINDOW *w, tetris_block block, tetris_block *shown);
+int display_score(WINDOW *w, tetris_game *tg);
 void init_colors(void);
 /***************************************************************************/
 
@@ -28,235 +86,447 @@ void init_colors(void);
 
 WINDOW *live_chat_border, *live_chat, *chat_box_border, *chat_box, *board, *next, *hold, *score;
 
+// Line being typed into the chat box (see chat_input.h), allocated once and reused for every message
+chat_input chat_in;
+
+// Lines shown in the live chat (see chat_history.h), within a memory budget which may be set in KiB with -c; how many
+// lines the view is scrolled back from the newest one; and the number of the line found by the last search, which is
+// highlighted, or -1
+chat_history chat_hist;
+long chat_history_kib = CHAT_HISTORY_KIB;
+unsigned long chat_scroll = 0;
+long chat_match = -1;
+int chat_dirty = 0; // whether the live chat changed since it was last drawn, see display_chat_history
+
+// Whether any window was staged for the next flush of the screen, see flush_screen; in headless mode, whether any frame
+// was written since the output was last flushed
+int screen_dirty = 0;
+
+// Headless mode, enabled with -H, for bots and automated clients: ncurses is not used at all, commands are read as
+// lines from stdin, or from a client of a UNIX socket, and the game is reported by compact frames written back to it
+// (see run_headless_command and emit_frame). Keyboard input, or the commands, are read from input_fd.
+int headless = 0;
+char* headless_path = NULL;
+int input_fd = STDIN_FILENO;
+FILE* headless_out;
+char headless_line[HEADLESS_LINE_MAX];
+size_t headless_len = 0;
+int headless_discarding = 0; // whether the rest of a line too long to be kept is being skipped, up to its end
+long game_ticks; // ticks of the current game, for the frames
+
 // Flags -- self explanatory
 int in_game = 0;
 int connection_open = 0;
 int server_err = 0;
+int exiting = 0; // set once the main loop is left, for the server message thread to stop; guarded by serverConnectionMutex
 
 // See Stephen Brennan's implementation
 tetris_game* tg;
-tetris_move curr_move;
+
+// Moves made since the last tick, all applied by the next one in order (see tg_tick_moves); any more are dropped
+tetris_move input_moves[TG_MAX_MOVES];
+int n_input_moves;
+
+// Auto-shift: while left or right is held, the falling block moves that way every arr_ms, once das_ms passed since the
+// key was pressed; both may be set, with -D and -A. The key last pressed among the two, when it was last pressed or
+// repeated by the terminal, how many times it was repeated in a row, the interval between the last two repeats, and
+// when the next auto-shift is due
+struct{
+    tetris_move move;
+    long long last_nsec, interval_nsec, next_shift_nsec;
+    int repeats;
+} shift;
+int das_ms = DAS_MS, arr_ms = ARR_MS;
+
+// Deadlines, on the monotonic clock, of the next simulation tick and the next rendered frame
+long long next_tick_nsec, next_frame_nsec;
+
+// Directory into which every game is recorded as a replay (see tetris_replay.h), if given with -r, and the recorder of
+// the game currently running
+char* replay_dir = NULL;
+tetris_recorder* recorder = NULL;
+
+// Autoplayer, enabled with -a and the number of blocks it looks ahead (see tetris_search.h), which places the falling
+// block whenever no key was pressed since the last tick, at most once every AUTOPLAY_NSEC; and when it may next do so.
+// Searches run on a thread of their own, on a snapshot of the game (see tg_save), so as not to hold up the main loop;
+// the snapshot, the state of the search and the plan it found are guarded by autoplayMutex, with requests signalled
+// through autoplayCond. The main thread checks plans on a game of its own before queueing their moves, see autoplay.
+enum {AUTOPLAY_IDLE, AUTOPLAY_REQUESTED, AUTOPLAY_DONE};
+int autoplay_depth = 0;
+tetris_search* autoplayer = NULL;
+long long next_autoplay_nsec;
+pthread_t autoplay_thread;
+pthread_mutex_t autoplayMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t autoplayCond = PTHREAD_COND_INITIALIZER;
+int autoplay_state = AUTOPLAY_IDLE, autoplay_stop = 0, autoplay_found;
+unsigned char* autoplay_snapshot = NULL;
+size_t autoplay_snapshot_size = 0, autoplay_snapshot_len;
+int autoplay_rows, autoplay_cols;
+tetris_plan autoplay_plan;
+tetris_game* autoplay_check = NULL;
+
+// What is currently drawn in the next, hold and score windows, so that these are only redrawn when it changes
+tetris_block next_shown, hold_shown;
+int points_shown, level_shown, lines_shown;
+
+// Instrumentation (see metrics.h): how long each stage of the main loop takes, how many server messages are waiting in
+// the inbox on each pass, and what is sent to the server. Every METRICS_PERIOD_NSEC, the p50 and p99 of each stage are
+// shown in the debug window if enabled with -d, and written to the file given with -m, if any.
+enum {METRIC_TICK, METRIC_RENDER, METRIC_FLUSH, METRIC_MSGS, METRIC_WAIT, METRIC_INBOX, N_METRIC_HISTS};
+metric_hist metric_hists[N_METRIC_HISTS] = {
+    {"tetris_frontend_tick_seconds", "Time spent simulating a game tick.", 1e9},
+    {"tetris_frontend_render_seconds", "Time spent drawing the windows which changed, per frame.", 1e9},
+    {"tetris_frontend_flush_seconds", "Time spent flushing the screen to the terminal, per flush.", 1e9},
+    {"tetris_frontend_msgs_seconds", "Time spent handling server messages, per pass with messages waiting.", 1e9},
+    {"tetris_frontend_wait_seconds", "Time spent waiting for input, messages or deadlines, per wait.", 1e9},
+    {"tetris_frontend_inbox_depth", "Server messages waiting in the inbox, per pass.", 1}
+};
+enum {METRIC_SENT_MSGS, METRIC_SENT_BYTES, N_METRIC_COUNTERS};
+metric_counter metric_counters[N_METRIC_COUNTERS] = {
+    {"tetris_frontend_sent_messages_total", "Messages sent to the server."},
+    {"tetris_frontend_sent_bytes_total", "Bytes of message data sent to the server."}
+};
+int debug_enabled = 0;
+WINDOW* debug_win = NULL;
+char* metrics_path = NULL;
+long long next_metrics_nsec;
 
 // Multi--threading environment
+int msg_event_fd; // eventfd signalled by the server message thread whenever it queues a message
+msg_inbox inbox;  // server messages, moved from the client library's queue by the server message thread
 pthread_mutex_t serverConnectionMutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_t server_conn_thread;
 pthread_t accept_p2p_thread;
 pthread_t score_update_thread;
 
+// Score publisher: the latest score of the game, whether it changed since it was last sent to the server, and whether
+// the publisher should stop once it flushed it; all guarded by scoreMutex, with changes signalled through scoreCond.
+// Scores are sent at most once every score_interval_ms, which may be set with -s.
+pthread_mutex_t scoreMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t scoreCond;
+int score_latest, score_changed, score_stop;
+int score_interval_ms = SCORE_INTERVAL_MS;
+
 // FUNC DEFNS
 
-void send_chat_msg();
+void send_chat_msg(const char* text);
+void read_chat_input();
+void display_chat_input();
+void add_chat_lines(const char* text);
+void scroll_chat(long lines);
+void search_chat(const char* needle);
+void display_chat_history();
+void open_headless();
+int read_headless_input();
+void run_headless_command(const char* line);
+void emit_frame();
+void stage_window(WINDOW* w);
+void flush_screen();
+int handle_server_msgs(int rows, int cols);
+void push_server_msg(msg m);
+int is_exiting();
+int send_server_msg(msg m);
+void roll_metrics();
 void game_cleanup();
 void curses_cleanup();
 void start_game(int rows, int cols);
+void game_tick();
+void render_game();
+void read_game_input();
+void queue_move(tetris_move move);
+void autoplay();
+int autoplay_plan_valid();
+void* autoplay_search(void* arg);
+void press_shift(tetris_move move, long long now);
+void auto_shift(long long now);
+void publish_score(int points);
 void* score_update(void* arg);
 void* get_server_msgs(void* arg);
-int get_chat_box_char(msg to_send, int i);
 
 /* The main loop of the front end, which after taking care of initialisation and correct connection to the server,
  * via appropriate calls to the client library.
  *
  * Side note: As mentioned in the project report, running multiple instances on the same machine may lead to flickering
  * if there are not enough resources available. This is because ncurses typically needs a few milliseconds to update the
- * entire screen etc, in an ideal situation.
+ * entire screen etc, in an ideal situation. To keep this down, the screen is updated at most once per pass of the main
+ * loop, with all the windows which changed at once (see flush_screen).
  */
 int main(int argc, char* argv[]){
-    if(argc < 2){
+    int opt, bad_args = 0;
+    while((opt = getopt(argc, argv, "r:s:c:dm:D:A:H:a:")) != -1){
+        switch(opt){
+            case 'r': replay_dir = optarg; break; // record every game into the given directory
+            case 's': // least time in ms between score updates sent to the server
+                score_interval_ms = atoi(optarg);
+                bad_args |= score_interval_ms < 0;
+                break;
+            case 'c': // memory budget of the chat history, in KiB
+                chat_history_kib = atol(optarg);
+                bad_args |= chat_history_kib <= 0;
+                break;
+            case 'd': debug_enabled = 1; break; // show the debug window
+            case 'm': metrics_path = optarg; break; // write metrics to the given file
+            case 'D': // delayed auto-shift, in ms
+                das_ms = atoi(optarg);
+                bad_args |= das_ms < 0;
+                break;
+            case 'A': // auto-repeat rate, in ms between moves; 0 moves the block to the wall at once
+                arr_ms = atoi(optarg);
+                bad_args |= arr_ms < 0;
+                break;
+            case 'H': // headless mode, on stdin and stdout if -, otherwise on a UNIX socket at the given path
+                headless = 1;
+                headless_path = strcmp(optarg, "-") != 0 ? optarg : NULL;
+                break;
+            case 'a': // let the autoplayer play, looking the given number of blocks ahead; per block, a search takes
+                      // ~0.02ms at depth 1, 0.3-1.2ms at depth 2 and 100-250ms at depth 3, on the autoplayer's thread
+                autoplay_depth = atoi(optarg);
+                bad_args |= autoplay_depth < 1 || autoplay_depth > AUTOPLAY_MAX_DEPTH;
+                break;
+            default: bad_args = 1;
+        }
+    }
+
+    if(bad_args){
+        mrerror("Usage: CPS2008_Tetris_FrontEnd [-r replay_dir] [-s score_interval_ms] [-c chat_history_kib] [-d] "
+                "[-m metrics_file] [-D das_ms] [-A arr_ms] [-H -|socket_path] [-a depth] <server_ip>");
+    }
+
+    // a single block looked ahead is searched faster than threads are woken up, see tg_search_plan
+    if(autoplay_depth > 0){
+        if((autoplayer = tg_search_create(autoplay_depth, true, autoplay_depth > 1 ? 0 : 1)) == NULL ||
+           pthread_create(&autoplay_thread, NULL, autoplay_search, (void*) NULL) != 0){
+            mrerror("Error while creating the autoplayer");
+        }
+    }
+
+    if(optind >= argc){
         mrerror("IPv4 address of server not specified. Exiting...");
     }
 
-    client_init(argv[1]);
+    client_init(argv[optind]);
 
     if(server_fd >= 0){
         pthread_mutex_lock(&serverConnectionMutex);
         connection_open = 1;
         pthread_mutex_unlock(&serverConnectionMutex);
 
-        // setting up ncurses
-        initscr();
-        curs_set(0);
-        timeout(0);
-        cbreak();
-
-        // defining parameters for determining window sizes
+        // board dimensions, which also determine the window sizes
         int rows = 22; int cols = 10;
-        int max_x, max_y;
-        getmaxyx(stdscr, max_y, max_x);
-        int n_x_lines = max_x - 4 * (cols + 1);
-
-        // defining NCURSES windows and their properties
-
-        // the following are for the live chat portion of the screen...
-        live_chat_border = newwin(max_y - 5, n_x_lines, 0, 0);
-        live_chat = newwin(max_y - 7, n_x_lines - 2, 1, 1);
-        scrollok(live_chat, TRUE);
-        chat_box_border = newwin(5, n_x_lines, max_y - 5, 0);
-        chat_box = newwin(3, n_x_lines - 2, max_y - 4, 1);
-        wtimeout(chat_box, 0);
-
-        int offset_x = n_x_lines + 1;
-        int offset_y = 0;
-
-        // ...and these are for the tetris gameplay portion of the screen...
-        board = newwin(rows + 2, 2 * cols + 2, offset_y, offset_x);
-        next  = newwin(6, 10, offset_y, 2 * (cols + 1) + 1 + offset_x);
-        hold  = newwin(6, 10, 7 + offset_y, 2 * (cols + 1) + 1 + offset_x);
-        score = newwin(6, 10, 14 + offset_y, 2 * (cols + 1 ) + 1 + offset_x);
-
-        // draw basic borders
-        wborder(live_chat_border, '|', '|', '-', '-', '+', '+', '|', '|');
-        wborder(chat_box_border, '|', '|', '-', '-', '|', '|', '+', '+');
-
-        // printing titles and border
-        mvwprintw(live_chat, 0, 0, "Super Battle Tetris Chat Server\n\n");
-
-        // updating
-        wrefresh(live_chat_border);
-        wrefresh(chat_box_border);
-        wrefresh(live_chat);
-        wrefresh(chat_box);
-
-        // create threads for sending and receiving server messages while connection is open
+
+        if(headless){ // no terminal to set up, only the input and output of the bot driving the front end
+            open_headless();
+        }else{
+            // setting up ncurses
+            initscr();
+            curs_set(0);
+            timeout(0);
+            cbreak();
+            noecho(); // typed characters are drawn by display_chat_input, rather than echoed wherever the cursor is
+
+            // defining parameters for determining window sizes
+            int max_x, max_y;
+            getmaxyx(stdscr, max_y, max_x);
+            int n_x_lines = max_x - 4 * (cols + 1);
+
+            // defining NCURSES windows and their properties
+
+            // the following are for the live chat portion of the screen...
+            live_chat_border = newwin(max_y - 5, n_x_lines, 0, 0);
+            live_chat = newwin(max_y - 7, n_x_lines - 2, 1, 1);
+            chat_box_border = newwin(5, n_x_lines, max_y - 5, 0);
+            chat_box = newwin(3, n_x_lines - 2, max_y - 4, 1);
+            wtimeout(chat_box, 0);
+            keypad(chat_box, TRUE); // for the arrow keys, both in chat and in game
+
+            int offset_x = n_x_lines + 1;
+            int offset_y = 0;
+
+            // ...and these are for the tetris gameplay portion of the screen...
+            board = newwin(rows + 2, 2 * cols + 2, offset_y, offset_x);
+            next  = newwin(6, 10, offset_y, 2 * (cols + 1) + 1 + offset_x);
+            hold  = newwin(6, 10, 7 + offset_y, 2 * (cols + 1) + 1 + offset_x);
+            score = newwin(6, 10, 14 + offset_y, 2 * (cols + 1 ) + 1 + offset_x);
+
+            // ...and this is for the debug window, below the game, if enabled
+            if(debug_enabled){
+                debug_win = newwin(8, 2 * (cols + 1) + 11, rows + 2 + offset_y, offset_x); // NULL if it does not fit
+            }
+
+            // draw basic borders
+            wborder(live_chat_border, '|', '|', '-', '-', '+', '+', '|', '|');
+            wborder(chat_box_border, '|', '|', '-', '-', '|', '|', '+', '+');
+
+            // updating
+            stage_window(live_chat_border);
+            stage_window(chat_box_border);
+            stage_window(chat_box);
+        }
+
+        // create the chat history, and print the title into it; in headless mode, chat lines are written out instead
+        if(!headless){
+            if(!ch_init(&chat_hist, chat_history_kib * 1024)){
+                curses_cleanup(); // call ncurses clean up function on failure
+                mrerror("Error while allocating memory");
+            }
+            add_chat_lines("Super Battle Tetris Chat Server\n");
+            if(debug_enabled && debug_win == NULL){
+                add_chat_lines("The terminal is too small for the debug window.");
+            }
+        }
+        next_metrics_nsec = now_nsec() + METRICS_PERIOD_NSEC;
+
+        // create an eventfd through which the server message thread wakes up the main loop, then threads for sending and
+        // receiving server messages while connection is open
+        msg_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(msg_event_fd < 0){
+            curses_cleanup(); // call ncurses clean up function on failure
+            mrerror("Error while creating event descriptor for incoming server messages");
+        }
+
+        // the score publisher waits for changes with deadlines on the monotonic clock, as the main loop
+        pthread_condattr_t score_cond_attr;
+        pthread_condattr_init(&score_cond_attr);
+        pthread_condattr_setclock(&score_cond_attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&scoreCond, &score_cond_attr);
+        pthread_condattr_destroy(&score_cond_attr);
+
+        mi_init(&inbox);
         if(pthread_create(&server_conn_thread, NULL, get_server_msgs, (void*) NULL) != 0){
             curses_cleanup(); // call ncurses clean up function on failure
             mrerror("Error while creating thread to service incoming server messages");
         }
 
-        // create new msg instance to be used for sending chat messages to the server
-        int msg_to_send_idx = 0;
-        msg to_send;
-        to_send.msg_type = CHAT;
-        to_send.msg = malloc(1);
-        if(to_send.msg == NULL){
+        // create the line editor used for typing chat messages to the server
+        if(!ci_init(&chat_in)){
             mrerror("Error while allocating memory");
         }
+        if(!headless){
+            display_chat_input();
+        }
 
-        msg recv_server_msg;
+        int msgs_pending;
         while(1){ // main loop: either fetches keyboard input for sending a message over chat, or for playing a tetris game
             /* Note: we maintain a queue a messages so that the receive and decoding procedure can be handled by a
              * separate thread, reducing the time between refreshes on the screen (especially during game play) by the
-             * main thread.
+             * main thread. All messages waiting are handled at once, within a budget.
              */
-            recv_server_msg = dequeue_server_msg(); // dequeue_server_msg is a library function
-
-            if(recv_server_msg.msg_type == INVALID){ // if message was not received correctly, its tagged as INVALID
-                break; // in which case we break from the main loop, initiating the exit sequence
-            }
+            msgs_pending = handle_server_msgs(rows, cols);
 
-            switch(recv_server_msg.msg_type){ // otherwise if valid, handle accordingly
-                case CHAT: { // in the case of a chat message, simply print the data part along with a newline character
-                    waddstr(live_chat, recv_server_msg.msg);
-                    waddch(live_chat, '\n');
-                    wrefresh(live_chat);
-                } break;
-                // else if the message is NEW_GAME, call the handler function provided in the library
-                case NEW_GAME: handle_new_game_msg(recv_server_msg); break;
-                // and similarly if the message is a START_GAME message
-                case START_GAME: {
-                    start_game(rows, cols); // call the start_game convience function to setup a new game session on the frontend
-
-                    msg_to_send_idx = 0;
-                    to_send.msg = realloc(to_send.msg, 1);
-                    if(to_send.msg == NULL){
-                        mrerror("Error while allocating memory");
-                    }
-                } break; // otherwise queue was empty and hence message was tagged EMPTY
+            if(msgs_pending < 0){ // if a message was not received correctly
+                break; // we break from the main loop, initiating the exit sequence
             }
 
             if(!in_game){ // if player is not in game, keyboard input is bound to the live chat box
-                int ret = msg_to_send_idx;
-                // allocate 512 bytes for message; remove limitation? longer inputs are causing ncurses to misbehave
-                to_send.msg = realloc(to_send.msg, 512);
-                if(to_send.msg == NULL){
-                    mrerror("Error while allocating memory");
-                }
-
-                while(1){ // fetch input from the chat box until (i) error or (ii) user finished typing (iii) message exceeds 512 bytes
-                    ret = get_chat_box_char(to_send, ret);
-                    if(ret >= 0 && ret < 512){
-                        msg_to_send_idx = ret;
-                    }else{ break;}
-                }
-
-                if(ret == -1 || ret == 512){ // send message to the server if no error has occured
-                    send_chat_msg(to_send);
-
-                    // reset message ready for new input
-                    msg_to_send_idx = 0;
-                    to_send.msg = realloc(to_send.msg, 1);
-                    if(to_send.msg == NULL){
-                        mrerror("Error while allocating memory");
-                    }
+                if(!headless){
+                    read_chat_input();
+                }else if(read_headless_input() < 0){ // in headless mode, to commands; if the bot hung up, we exit
+                    break;
                 }
             }else{ // otherwise the input is bound to the tetris instance currently running, using the input to update
                    // the state of the game and any online oppononets.
 
-                int lines_cleared = tg_tick(tg, curr_move); // tg_tick iterates the game play by one move and returns no. of lines cleared
-                gameSession.total_lines_cleared += lines_cleared;
-
-                // in case of rising tide: (state being shared between clients over the P2P network in this case)
-                if(gameSession.game_type == RISING_TIDE){
-                    tg_add_lines(tg, get_lines_to_add());
-                    send_cleared_lines(lines_cleared);
-                }
-
-                // check if game is over and change in_game flag accordingly; this depends on the game mode eg. if timed etc
-                if(tg_game_over(tg)
-                   || (gameSession.game_type == FAST_TRACK && gameSession.total_lines_cleared == gameSession.n_winlines)
-                   || (gameSession.game_type == BOOMER && difftime(time(NULL), gameSession.start_time) >= (gameSession.time * 60))){
-
-                    in_game = 0;
+                /* The simulation runs on a fixed timestep, against the monotonic clock: every TICK_NSEC that elapsed since
+                 * the last tick is simulated, independently of how long rendering or message handling took. Hence
+                 * gravity runs at the same speed on every machine. Rendering is capped at FRAME_RATE and sleeping
+                 * happens until whichever deadline is next.
+                 */
+                if(!headless){
+                    read_game_input();
+                }else if(read_headless_input() < 0){
+                    break;
                 }
 
-                // update the ncurses windows to reflect the changes arising from the new move
-                display_board(board, tg);
-                display_piece(next, tg->next);
-                display_piece(hold, tg->stored);
-                display_score(score, tg);
-
-                wrefresh(board);
-                wrefresh(next);
-                wrefresh(hold);
-                wrefresh(score);
-                sleep_milli(10); // enough time for ncurses to update the terminal window
-
-                switch(mvwgetch(chat_box, 0, 0)){ // fetch user input and bind to a game move
-                    case KEY_LEFT:
-                        curr_move = TM_LEFT;
-                        break;
-                    case KEY_RIGHT:
-                        curr_move = TM_RIGHT;
-                        break;
-                    case KEY_UP:
-                        curr_move = TM_CLOCK;
-                        break;
-                    case KEY_DOWN:
-                        curr_move = TM_DROP;
-                        break;
-                    case 'q':
-                        in_game = 0;
-                        curr_move = TM_NONE;
+                long long now = now_nsec();
+                int n_ticks = 0;
+                while(in_game && now >= next_tick_nsec){
+                    if(n_ticks == MAX_CATCHUP_TICKS){ // stalled for too long: drop the backlog rather than fast-forward
+                        next_tick_nsec = now + TICK_NSEC;
                         break;
-                    case ' ':
-                        curr_move = TM_HOLD;
-                        break;
-                    default:
-                        curr_move = TM_NONE;
+                    }
+
+                    long long tick_start = now_nsec();
+                    game_tick();
+                    mt_record(&metric_hists[METRIC_TICK], now_nsec() - tick_start);
+                    next_tick_nsec += TICK_NSEC;
+                    n_ticks++;
                 }
 
-                // update the users score in a thread-safe manner using the set_score library function
-                // recall that the score field is being accessed periodically by the score update thread
+                // update the users score in a thread-safe manner using the set_score library function, and hand it
+                // to the score update thread, which sends it to the server if it changed
                 set_score(tg->points);
+                publish_score(tg->points);
+
+                if(in_game && now >= next_frame_nsec){
+                    long long render_start = now_nsec();
+                    if(!headless){
+                        render_game();
+                    }else{
+                        emit_frame();
+                    }
+                    mt_record(&metric_hists[METRIC_RENDER], now_nsec() - render_start);
+                    next_frame_nsec = now + FRAME_NSEC;
+                }
 
                 if(!in_game){
                     game_cleanup();
-                    flushinp();
+                    if(!headless){
+                        flushinp();
+                    }
                 }
             }
+
+            // draw the changes to the live chat of this pass, if any, at once; during a game, render_game does along
+            // with the next frame
+            if(chat_dirty && !in_game){
+                long long render_start = now_nsec();
+                display_chat_history();
+                mt_record(&metric_hists[METRIC_RENDER], now_nsec() - render_start);
+            }
+
+            // at the end of each period, update the debug window and the metrics file
+            if(now_nsec() >= next_metrics_nsec){
+                roll_metrics();
+            }
+
+            // then bring the terminal up to date with every window staged during this pass, with a single update
+            flush_screen();
+
+            /* Sleep until there is something to do: keyboard input, a newly queued server message, or during a game
+             * the next tick or frame deadline. If the budget for handling messages ran out, more are waiting, and we do
+             * not sleep at all.
+             */
+            if(!msgs_pending){
+                long long deadline = -1;
+                if(in_game){
+                    deadline = next_tick_nsec < next_frame_nsec ? next_tick_nsec : next_frame_nsec;
+                }
+                if((debug_win != NULL || metrics_path != NULL) && (deadline < 0 || next_metrics_nsec < deadline)){
+                    deadline = next_metrics_nsec; // wake up for the end of the period too
+                }
+
+                long long wait_start = now_nsec();
+                wait_for_events(deadline);
+                mt_record(&metric_hists[METRIC_WAIT], now_nsec() - wait_start);
+            }
+        }
+
+        // the server message thread stops by itself once the server disconnects; otherwise, e.g. when the bot driving
+        // the front end in headless mode hung up, it has to be told to
+        pthread_mutex_lock(&serverConnectionMutex);
+        exiting = 1;
+        pthread_mutex_unlock(&serverConnectionMutex);
+
+        if(recorder != NULL){ // keep the replay of a game cut short by a disconnection
+            tr_record_close(recorder);
         }
 
         curses_cleanup(); // on termination of main loop, clean up ncurses to restore terminal session to original state
 
+        if(headless){
+            fflush(headless_out);
+        }
+
         if(server_err){
             smrerror("Server disconnected abruptly.");
         }
@@ -269,6 +539,20 @@ int main(int argc, char* argv[]){
             mrerror("Error while terminating chat services.");
         }
 
+        close(msg_event_fd);
+        if(autoplayer != NULL){ // stop the autoplayer, once done with the search it may be running
+            pthread_mutex_lock(&autoplayMutex);
+            autoplay_stop = 1;
+            pthread_cond_signal(&autoplayCond);
+            pthread_mutex_unlock(&autoplayMutex);
+
+            pthread_join(autoplay_thread, NULL);
+            tg_search_delete(autoplayer);
+            free(autoplay_snapshot);
+        }
+        ci_destroy(&chat_in);
+        ch_destroy(&chat_hist);
+
         if(server_err){
             mrerror("Exiting due to server disconnection...");
         }
@@ -279,23 +563,100 @@ int main(int argc, char* argv[]){
     return 0;
 }
 
+/* Handles the server messages waiting in the inbox, up to MAX_MSGS_PER_PASS of them or for up to MSG_BUDGET_NSEC.
+ * Returns -1 if a message was not received correctly, in which case the front end exits; otherwise 1 if the budget ran
+ * out, hence more messages may be waiting, or 0 if the inbox was emptied.
+ */
+int handle_server_msgs(int rows, int cols){
+    long long start = now_nsec(), deadline = start + MSG_BUDGET_NSEC;
+    size_t depth = mi_depth(&inbox);
+    msg recv_server_msg;
+
+    mt_record(&metric_hists[METRIC_INBOX], depth);
+    if(depth == 0){
+        return 0;
+    }
+
+    for(int n = 0; n < MAX_MSGS_PER_PASS; n++){
+        if(!mi_pop(&inbox, &recv_server_msg)){
+            mt_record(&metric_hists[METRIC_MSGS], now_nsec() - start);
+            return 0;
+        }
+
+        switch(recv_server_msg.msg_type){
+            case INVALID: return -1; // if message was not received correctly, its tagged as INVALID
+            case CHAT: { // in the case of a chat message, simply add the data part to the chat history
+                add_chat_lines(recv_server_msg.msg);
+            } break;
+            // else if the message is NEW_GAME, call the handler function provided in the library
+            case NEW_GAME: handle_new_game_msg(recv_server_msg); break;
+            // and similarly if the message is a START_GAME message
+            case START_GAME: {
+                start_game(rows, cols); // call the start_game convience function to setup a new game session on the frontend
+                ci_clear(&chat_in); // discarding any message being typed
+            } break;
+        }
+
+        if(now_nsec() >= deadline){
+            break;
+        }
+    }
+
+    mt_record(&metric_hists[METRIC_MSGS], now_nsec() - start);
+    return 1;
+}
+
+// Pushes a server message into the inbox, waiting for the main loop to make room if it is full, unless it was left
+void push_server_msg(msg m){
+    while(!mi_push(&inbox, m) && !is_exiting()){
+        struct timespec wait = {0, 1000000L};
+        nanosleep(&wait, NULL);
+    }
+}
+
+// Whether the main loop was left, in a thread-safe manner
+int is_exiting(){
+    pthread_mutex_lock(&serverConnectionMutex);
+    int ret = exiting;
+    pthread_mutex_unlock(&serverConnectionMutex);
+
+    return ret;
+}
+
 /* Simple threaded function that repeatedly calls the library provided enqueue_server_msg function, to fetch messages
- * from the server.
+ * from the server, and moves them from the library's queue into the front end's inbox.
  *
  * Note: we maintain a queue a messages so that the receive and decoding procedure can be handled by a
  * separate thread, reducing the time between refreshes on the screen (especially during game play) by the
- * main thread.
+ * main thread. The inbox has a single producer and a single consumer, hence the main thread takes them without
+ * contending for the library's lock.
  */
 void* get_server_msgs(void* arg){
-    msg recv_server_msg;
+    msg recv_server_msg, queued_msg;
+    int disconnected = 0;
 
-    while(1){
+    while(!disconnected && !is_exiting()){
         // Note that enqueue_server_msg has a time-out select call, hence the call is non--blocking.
         // If data is not available after time-out but the server is still connected, a msg of type EMPTY is returned.
         // If the server disconnects then after the the time out, the function return a msg of type INVALID.
         recv_server_msg = enqueue_server_msg(server_fd);
+        if(recv_server_msg.msg_type == EMPTY){
+            continue;
+        }
 
-        if(recv_server_msg.msg_type == INVALID){
+        // this thread is the only one using the library's queue, hence it holds just the messages enqueued above
+        while((queued_msg = dequeue_server_msg()).msg_type != EMPTY){
+            push_server_msg(queued_msg);
+            disconnected |= queued_msg.msg_type == INVALID;
+        }
+        if(recv_server_msg.msg_type == INVALID && !disconnected){ // make sure the main loop learns of a disconnection
+            push_server_msg(recv_server_msg);
+            disconnected = 1;
+        }
+
+        // wake up the main loop, which otherwise sleeps until there is input or a message to handle
+        uint64_t one = 1;
+        if(write(msg_event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN){
             break;
         }
     }
@@ -303,63 +664,403 @@ void* get_server_msgs(void* arg){
     pthread_exit(NULL);
 }
 
-/* Utility function for fetching characters from the live chat box, while:
- * (i)   Checking if getch was successful (if not, we return -2)
- * (ii)  Checking if the character was a \n, \r or EOF indicating that the user wishes to send the message (in this case
- *       we return -1 and null terminate the data part of the message)
- * (iii) Check if the character denotes a backspace, in which case we clear one character from the screen and remove the
- *       last character appended to the data part of the message (in this case we return the index of the result last character)
- * (iv)  Otherwise we append the character to the data part of the message and return the new index pointing to the last
- *       character.
+/* Fetches all pending characters from the chat box, and applies them to the line being typed:
+ * (i)   A \n or \r sends the line to the server, and starts a new one; unless it is a /search command, which searches
+ *       the chat history instead (see search_chat).
+ * (ii)  Backspace and delete remove the character before and after the cursor respectively.
+ * (iii) The left and right arrows, home and end move the cursor; page up and page down scroll the chat history.
+ * (iv)  Any other character is inserted at the cursor; lines longer than the chat box scroll horizontally.
+ * The chat box is redrawn once, after all pending characters were applied.
  */
-int get_chat_box_char(msg to_send, int i){ // i = index of where to add character in the data part
-    int c = mvwgetch(chat_box, 0, i);
+void read_chat_input(){
+    int c, changed = 0;
+
+    while((c = wgetch(chat_box)) != ERR){
+        switch(c){
+            case '\n': case '\r': case KEY_ENTER: {
+                const char* line = ci_text(&chat_in);
+                size_t n = strlen(CHAT_SEARCH);
+
+                if(strncmp(line, CHAT_SEARCH, n) == 0 && (line[n] == ' ' || line[n] == '\0')){
+                    search_chat(line[n] == ' ' ? line + n + 1 : line + n);
+                    ci_clear(&chat_in);
+                }else{
+                    send_chat_msg(line);
+                    ci_clear(&chat_in); // ready for new input
+                }
+            } break;
+            case KEY_BACKSPACE: case 127: case '\b': ci_backspace(&chat_in); break;
+            case KEY_DC: ci_delete(&chat_in); break;
+            case KEY_LEFT:
+                if(ci_cursor(&chat_in) > 0){
+                    ci_move(&chat_in, ci_cursor(&chat_in) - 1);
+                }
+                break;
+            case KEY_RIGHT: ci_move(&chat_in, ci_cursor(&chat_in) + 1); break;
+            case KEY_HOME: ci_move(&chat_in, 0); break;
+            case KEY_END: ci_move(&chat_in, ci_length(&chat_in)); break;
+            case KEY_PPAGE: scroll_chat(getmaxy(live_chat) - 1); break;
+            case KEY_NPAGE: scroll_chat(1 - getmaxy(live_chat)); break;
+            default:
+                if(c < ' ' || c > 0xff){ // ignore other control characters and function keys
+                    continue;
+                }
+                if(!ci_insert(&chat_in, (char) c)){
+                    curses_cleanup(); // call ncurses clean up function on failure
+                    mrerror("Error while allocating memory");
+                }
+        }
+        changed = 1;
+    }
+
+    if(changed){
+        display_chat_input();
+    }
+}
+
+// Draws the line being typed on the first row of the chat box, scrolled so that the cursor, shown in reverse video,
+// stays in view
+void display_chat_input(){
+    int width = getmaxx(chat_box);
+    size_t first = ci_scroll(&chat_in, width), length = ci_length(&chat_in), cursor = ci_cursor(&chat_in);
+
+    wmove(chat_box, 0, 0);
+    wclrtoeol(chat_box);
+    for(size_t i = first; i < first + width && i <= length; i++){
+        chtype ch = i < length ? (unsigned char) ci_at(&chat_in, i) : ' ';
+        mvwaddch(chat_box, 0, i - first, i == cursor ? ch | A_REVERSE : ch);
+    }
+
+    stage_window(chat_box);
+}
+
+// Adds text to the chat history, one line per line of text, and redraws the live chat; if it is scrolled back, the view
+// stays on the same lines. In headless mode, each line is written out as a chat frame instead.
+void add_chat_lines(const char* text){
+    const char* end;
+    unsigned long added = 0;
+
+    do{
+        end = strchr(text, '\n');
+        size_t len = end != NULL ? (size_t) (end - text) : strlen(text);
+        if(headless){
+            fprintf(headless_out, "C %.*s\n", (int) len, text);
+        }else{
+            ch_add(&chat_hist, text, len);
+        }
+        text += len + 1;
+        added++;
+    }while(end != NULL);
 
-    if(c == ERR){
-        return -2; // signal error
+    if(headless){ // flushed at the end of the pass, along with any frames
+        screen_dirty = 1;
+        return;
     }
-    else if(c == '\n' || c == EOF || c == '\r'){
-        to_send.msg[i] = '\0';
-        return -1; // signal that user has finished input
+
+    if(chat_scroll > 0){
+        scroll_chat(added);
+    }
+    chat_dirty = 1;
+}
+
+// Scrolls the live chat back by the given number of lines, or forward if negative; scrolling back stops once the oldest
+// line is in view, or where a search left the view if further back
+void scroll_chat(long lines){
+    unsigned long n_lines = ch_end(&chat_hist) - ch_begin(&chat_hist), height = getmaxy(live_chat);
+    unsigned long max_scroll = n_lines > height ? n_lines - height : 0;
+
+    if(lines < 0 && (unsigned long) -lines > chat_scroll){
+        chat_scroll = 0;
+    }else if(lines > 0 && chat_scroll + lines > max_scroll){
+        chat_scroll = chat_scroll > max_scroll ? chat_scroll : max_scroll;
+    }else{
+        chat_scroll += lines;
     }
-    else if((c == KEY_BACKSPACE || c == 127 || c == '\b') && i > 0){ // clear char from screen and remove from data part
-        i--;
-        to_send.msg[i] = '\0';
-        wdelch(chat_box);
+
+    chat_dirty = 1;
+}
+
+/* Searches the chat history for the newest line containing needle, above the line found by the previous search if
+ * any, otherwise above the bottom of the view; hence repeating a search steps back through older matches. The line
+ * found is highlighted, and scrolled to the bottom of the view. If there is no such line, the terminal beeps; an empty
+ * needle instead clears the search and scrolls back to the newest line.
+ */
+void search_chat(const char* needle){
+    unsigned long found, before = chat_match >= 0 ? (unsigned long) chat_match : ch_end(&chat_hist) - chat_scroll;
+
+    if(*needle == '\0'){
+        chat_match = -1;
+        chat_scroll = 0;
+    }else if(ch_search(&chat_hist, needle, before, &found)){
+        chat_match = (long) found;
+        chat_scroll = ch_end(&chat_hist) - 1 - found;
     }else{
-        to_send.msg[i] = (char) c; // append new char
-        i++; // increment index
+        chat_match = -1;
+        beep();
+    }
+
+    chat_dirty = 1;
+}
+
+// Draws the lines of the chat history in view, from the bottom of the live chat up, wrapping lines longer than the
+// window; only the lines in view are visited. The functions changing the chat history or its view only set chat_dirty,
+// and the main loop calls this once per pass, or once per frame during a game, to draw all their changes at once.
+void display_chat_history(){
+    int height, width;
+    getmaxyx(live_chat, height, width);
+
+    werase(live_chat);
+    chat_dirty = 0;
+
+    unsigned long n = ch_end(&chat_hist) - chat_scroll;
+    int row = height;
+    while(row > 0 && n > ch_begin(&chat_hist)){
+        size_t len;
+        const char* line = ch_line(&chat_hist, --n, &len);
+        int n_rows = len == 0 ? 1 : (int) ((len + width - 1) / width);
+
+        row -= n_rows;
+        if((long) n == chat_match){
+            wattron(live_chat, A_REVERSE);
+        }
+        for(int i = 0; i < n_rows; i++){
+            if(row + i >= 0){ // lines partly above the top of the view are cut
+                mvwaddnstr(live_chat, row + i, 0, line + (size_t) i * width, width);
+            }
+        }
+        wattroff(live_chat, A_REVERSE);
+    }
+
+    stage_window(live_chat);
+}
+
+/* The screen is updated once per pass of the main loop: windows are only staged as they are drawn, with wnoutrefresh,
+ * and flush_screen then writes out all their changes at once, with doupdate. This makes for a single write to the
+ * terminal per frame, rather than one per window, and none at all if nothing was drawn. In headless mode, the frames
+ * written during the pass are flushed at once in the same way.
+ */
+void stage_window(WINDOW* w){
+    wnoutrefresh(w);
+    screen_dirty = 1;
+}
+
+void flush_screen(){
+    if(screen_dirty){
+        long long start = now_nsec();
+        if(headless){
+            fflush(headless_out);
+        }else{
+            doupdate();
+        }
+        mt_record(&metric_hists[METRIC_FLUSH], now_nsec() - start);
+        screen_dirty = 0;
+    }
+}
+
+/* Sets up the input and output of headless mode: stdin and stdout, or else a UNIX socket at headless_path, on which a
+ * single client is accepted, the bot driving the front end. A bot hanging up makes the front end exit (see
+ * read_headless_input), rather than be killed by SIGPIPE when writing to it.
+ */
+void open_headless(){
+    signal(SIGPIPE, SIG_IGN);
+
+    if(headless_path == NULL){
+        input_fd = STDIN_FILENO;
+        headless_out = stdout;
+        return;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(headless_path) >= sizeof(addr.sun_path)){
+        mrerror("Path of the headless socket is too long");
+    }
+    strcpy(addr.sun_path, headless_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(headless_path); // left over by a previous run, if any
+    if(listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0){
+        mrerror("Error while creating the headless socket");
+    }
+
+    input_fd = accept(listen_fd, NULL, NULL); // wait for the bot to connect
+    close(listen_fd);
+    unlink(headless_path);
+    if(input_fd < 0 || (headless_out = fdopen(input_fd, "w")) == NULL){
+        mrerror("Error while accepting a connection on the headless socket");
+    }
+}
+
+/* Reads all pending input in headless mode, and runs every complete line as a command (see run_headless_command); a
+ * partial line is kept until the rest of it arrives, and a line longer than HEADLESS_LINE_MAX is dropped whole.
+ * Returns -1 if the bot hung up, or can no longer be written to, in which case the front end exits; 0 otherwise.
+ */
+int read_headless_input(){
+    struct pollfd fd = {input_fd, POLLIN, 0};
+
+    while(poll(&fd, 1, 0) > 0){
+        ssize_t n = read(input_fd, headless_line + headless_len, sizeof(headless_line) - headless_len);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }else if(n <= 0){
+            return -1;
+        }
+
+        size_t end = headless_len + n, start = 0;
+        for(size_t i = headless_len; i < end; i++){
+            if(headless_line[i] == '\n'){
+                headless_line[i] = '\0';
+                if(!headless_discarding){
+                    run_headless_command(headless_line + start);
+                }
+                headless_discarding = 0;
+                start = i + 1;
+            }
+        }
+
+        headless_len = end - start;
+        if(headless_len == sizeof(headless_line) || (headless_discarding && headless_len > 0)){
+            // no end of line in sight: drop the line, along with whatever comes of it up to its end, rather than run
+            // its tail as a command of its own
+            headless_len = 0;
+            headless_discarding = 1;
+        }
+        memmove(headless_line, headless_line + start, headless_len);
     }
 
-    return i; // return index pointing to last char in msg data part
+    return ferror(headless_out) ? -1 : 0;
 }
 
-// Wrapper function to the send_msg library function, which handles disconnection and updating of NCURSES chat windows
-void send_chat_msg(msg to_send){
+/* Runs a command of headless mode, given by its first character:
+ * (i)   m followed by moves, one letter each, queues these for the next tick, as keys pressed during a game would:
+ *       l and r move left and right, c and w rotate clockwise and counter-clockwise, d drops and h holds.
+ * (ii)  s followed by a space and text sends text to the chat.
+ * (iii) q quits the current game.
+ * Unknown commands, and moves outside of games, are ignored.
+ */
+void run_headless_command(const char* line){
+    switch(line[0]){
+        case 'm':
+            for(const char* c = line + 1; in_game && *c != '\0'; c++){
+                const char* moves = "lrcwdh"; // in the order of tetris_move
+                const char* move = strchr(moves, *c);
+                if(move != NULL){
+                    queue_move((tetris_move) (move - moves));
+                }
+            }
+            break;
+        case 's':
+            send_chat_msg(line[1] == ' ' ? line + 2 : line + 1);
+            break;
+        case 'q':
+            in_game = 0;
+            n_input_moves = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+/* Writes a frame of the game in headless mode, if anything changed since the last one:
+ *     F <tick> <points> <level> <lines_remaining> <typ>:<ori>:<row>:<col> <next typ> <hold typ> <row>,<row>,...
+ * describing the falling block, followed by the locked cells of each row from the top, in hex, with column j as bit j.
+ * The engine marks the rows touched by any change, the falling block included, hence these tell whether anything did.
+ */
+void emit_frame(){
+    int changed = 0;
+    for(int i = 0; i < tg->rows && !changed; i++){
+        changed = tg_row_dirty(tg, i);
+    }
+    if(!changed){
+        return;
+    }
+    tg_clear_dirty(tg);
+
+    fprintf(headless_out, "F %ld %d %d %d %d:%d:%d:%d %d %d ", game_ticks, tg->points, tg->level, tg->lines_remaining,
+            tg->falling.typ, tg->falling.ori, tg->falling.loc.row, tg->falling.loc.col, tg->next.typ, tg->stored.typ);
+    for(int i = 0; i < tg->rows; i++){
+        fprintf(headless_out, i + 1 < tg->rows ? "%llx," : "%llx\n", (unsigned long long) tg->rowbits[i]);
+    }
+    screen_dirty = 1;
+}
+
+// Wrapper function to the send_msg library function, which counts the messages and bytes sent; called by both the main
+// thread and the score update thread
+int send_server_msg(msg m){
+    int ret = send_msg(m, server_fd);
+
+    if(ret >= 0){
+        mt_add(&metric_counters[METRIC_SENT_MSGS], 1);
+        mt_add(&metric_counters[METRIC_SENT_BYTES], strlen(m.msg) + 1);
+    }
+
+    return ret;
+}
+
+/* Ends the current metrics period: takes the p50 and p99 of every stage over the period, and shows them in the debug
+ * window and writes them to the metrics file, as enabled. If the metrics file cannot be written, a message is shown in
+ * the chat, and no more attempts are made.
+ */
+void roll_metrics(){
+    static const char* labels[N_METRIC_HISTS] = {"tick", "render", "flush", "msgs", "wait", "inbox"};
+
+    for(int i = 0; i < N_METRIC_HISTS; i++){
+        mt_roll(&metric_hists[i]);
+    }
+    next_metrics_nsec = now_nsec() + METRICS_PERIOD_NSEC;
+
+    if(debug_win != NULL){
+        werase(debug_win);
+        mvwprintw(debug_win, 0, 0, "%-7s%10s%10s", "us", "p50", "p99");
+        for(int i = 0; i < METRIC_INBOX; i++){
+            mvwprintw(debug_win, i + 1, 0, "%-7s%10.1f%10.1f", labels[i], metric_hists[i].p50 / 1e3,
+                      metric_hists[i].p99 / 1e3);
+        }
+        mvwprintw(debug_win, METRIC_INBOX + 1, 0, "%-7s%10llu%10llu", labels[METRIC_INBOX],
+                  (unsigned long long) metric_hists[METRIC_INBOX].p50,
+                  (unsigned long long) metric_hists[METRIC_INBOX].p99);
+        mvwprintw(debug_win, METRIC_INBOX + 2, 0, "sent %llu msgs, %llu B",
+                  (unsigned long long) mt_read(&metric_counters[METRIC_SENT_MSGS]),
+                  (unsigned long long) mt_read(&metric_counters[METRIC_SENT_BYTES]));
+        stage_window(debug_win);
+    }
+
+    if(metrics_path != NULL &&
+       !mt_export(metrics_path, metric_hists, N_METRIC_HISTS, metric_counters, N_METRIC_COUNTERS)){
+        add_chat_lines("Could not write the metrics file; metrics will not be written.");
+        metrics_path = NULL;
+    }
+}
+
+// Wrapper function to the send_msg library function, which sends a chat message, typed in the chat box or given by a
+// headless command, and handles disconnection
+void send_chat_msg(const char* text){
+    msg to_send;
+    to_send.msg_type = CHAT;
+    to_send.msg = (char*) text;
+
     // if sending to server failed, in a thread--safe manner change the flags which indicate whether an error has occurred
     // while communicating with the server, and which indicate whether the connection is still open or not
-    if(send_msg(to_send, server_fd) < 0){
+    if(send_server_msg(to_send) < 0){
         pthread_mutex_lock(&serverConnectionMutex);
         connection_open = 0;
         server_err = 1;
         pthread_mutex_unlock(&serverConnectionMutex);
     }
-
-    // clear user input from chat box, ready for new input
-    wmove(chat_box, 0, 0);
-    wclrtobot(chat_box);
-    wrefresh(chat_box);
 }
 
 /* Called whenever a new game instance is started; In particular it is responsible for:
  * (i)   In the case of a multiplayer session, initiate the P2P setup functions using threading as necessary.
- * (ii)  Initiate a thread to periodically send score updates to the server.
+ * (ii)  Initiate a thread to send score updates to the server as the score changes.
  * (iii) Initiate a tetris game and change NCURSES behavior as necessary.
  */
 void start_game(int rows, int cols){
     in_game = 1; // set flag to signal game start i.e. user input redirected to game instead of chat
 
-    curr_move = TM_NONE; // initial tetris move declaration
+    n_input_moves = 0; // no moves made yet, and no key held
+    shift.move = TM_NONE;
+    next_autoplay_nsec = 0;
 
     int n_board_rows = rows;
     if(gameSession.game_type == FAST_TRACK){ // in case of a fast track, shorten the board by the number of baselines
@@ -367,6 +1068,36 @@ void start_game(int rows, int cols){
     }
 
     tg = tg_create(n_board_rows, cols, gameSession.seed); // initiate a tetris game instance
+    if(tg == NULL){ // out of memory, or too many baselines left no board to play on
+        curses_cleanup(); // call ncurses clean up function on failure
+        mrerror("Error while creating the game");
+    }
+    if(autoplayer != NULL && (autoplay_check = tg_create(n_board_rows, cols, gameSession.seed)) == NULL){
+        curses_cleanup();
+        mrerror("Error while creating the autoplayer");
+    }
+
+    if(replay_dir != NULL){ // record the game, from its seed and inputs, if requested
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/tetris_%ld_%d.replay", replay_dir, (long) time(NULL), gameSession.seed);
+
+        recorder = tr_record_open(path, n_board_rows, cols, gameSession.seed);
+        if(recorder == NULL){
+            add_chat_lines("Could not open replay file; this game will not be recorded.");
+        }
+    }
+
+    // nothing of the new game is drawn yet: the board rows start off dirty, and the remaining windows are invalidated;
+    // in headless mode, the start of the game is reported instead
+    game_ticks = 0;
+    if(!headless){
+        wborder(board, '|', '|', '-', '-', '+', '+', '+', '+');
+    }else{
+        fprintf(headless_out, "S %d %d %d %d\n", n_board_rows, cols, gameSession.seed, (int) gameSession.game_type);
+        screen_dirty = 1;
+    }
+    next_shown.typ = hold_shown.typ = -2;
+    points_shown = level_shown = lines_shown = -1;
 
     if(gameSession.game_type != CHILL){ // if multiplayer game session
         // create threads for accepting peer-to-peer connections
@@ -378,28 +1109,304 @@ void start_game(int rows, int cols){
         service_peer_connections(NULL); // run on main thread of front--end
     }
 
-    // create thread for sending periodic score updates to the server
+    // create thread for sending score updates to the server, starting with the initial score of the new game
+    score_latest = 0;
+    score_changed = 1;
+    score_stop = 0;
     if(pthread_create(&score_update_thread, NULL, score_update, (void*) NULL) != 0){
         curses_cleanup(); // call ncurses clean up function on failure
         mrerror("Error while creating thread to send score updates to game server");
     }
 
     // NCURSES initialization:
-    init_colors();         // setup tetris colors
-    keypad(chat_box, TRUE);
+    if(!headless){
+        init_colors();         // setup tetris colors
+    }
+
+    // first tick is due one timestep from now, the first frame straight away
+    next_frame_nsec = now_nsec();
+    next_tick_nsec = next_frame_nsec + TICK_NSEC;
+}
+
+// Advances the game by a single tick, applying the pending move, and updates the game session accordingly
+void game_tick(){
+    if(autoplayer != NULL){
+        autoplay();
+    }
+
+    // tg_tick_moves iterates the game play by one tick, applying the moves made since the last one, and returns no. of
+    // lines cleared
+    int lines_cleared = tg_tick_moves(tg, input_moves, n_input_moves);
+    if(recorder != NULL){
+        tr_record_moves(recorder, input_moves, n_input_moves);
+    }
+    n_input_moves = 0; // each key press is applied on exactly one tick
+    game_ticks++;
+    gameSession.total_lines_cleared += lines_cleared;
+
+    // in case of rising tide: (state being shared between clients over the P2P network in this case)
+    if(gameSession.game_type == RISING_TIDE){
+        // lines cleared by other players since the last tick, added by the engine as one burst of garbage lines with
+        // random holes at the end of the next tick
+        int lines_to_add = get_lines_to_add();
+        if(lines_to_add > 0){
+            tg_queue_garbage(tg, lines_to_add, TG_GARBAGE_RANDOM);
+            if(recorder != NULL){
+                tr_record_garbage(recorder, lines_to_add, TG_GARBAGE_RANDOM);
+            }
+        }
+        send_cleared_lines(lines_cleared);
+    }
+
+    // check if game is over and change in_game flag accordingly; this depends on the game mode eg. if timed etc
+    if(tg_game_over(tg)
+       || (gameSession.game_type == FAST_TRACK && gameSession.total_lines_cleared == gameSession.n_winlines)
+       || (gameSession.game_type == BOOMER && difftime(time(NULL), gameSession.start_time) >= (gameSession.time * 60))){
+
+        in_game = 0;
+    }
+}
+
+// Update the ncurses windows to reflect the current state of the game; only what changed is redrawn, see the display
+// functions, and staged for the flush of the screen at the end of the pass
+void render_game(){
+    screen_dirty |= display_board(board, tg);
+    screen_dirty |= display_piece(next, tg->next, &next_shown);
+    screen_dirty |= display_piece(hold, tg->stored, &hold_shown);
+    screen_dirty |= display_score(score, tg);
+    if(chat_dirty){ // chat messages received since the last frame
+        display_chat_history();
+    }
+}
+
+// Fetch all pending user input, and queue the moves it makes for the next tick, along with any auto-shift due
+void read_game_input(){
+    long long now = now_nsec();
+    int c;
+
+    while((c = wgetch(chat_box)) != ERR){ // without moving the cursor, which would make wgetch refresh the chat box
+        switch(c){
+            case KEY_LEFT:
+                press_shift(TM_LEFT, now);
+                break;
+            case KEY_RIGHT:
+                press_shift(TM_RIGHT, now);
+                break;
+            case KEY_UP:
+                queue_move(TM_CLOCK);
+                break;
+            case KEY_DOWN:
+                queue_move(TM_DROP);
+                break;
+            case 'q':
+                in_game = 0;
+                n_input_moves = 0;
+                return;
+            case ' ':
+                queue_move(TM_HOLD);
+                break;
+            default:
+                break;
+        }
+    }
+
+    auto_shift(now);
+}
+
+// Queue a move for the next tick, unless TG_MAX_MOVES are queued already
+void queue_move(tetris_move move){
+    if(n_input_moves < TG_MAX_MOVES){
+        input_moves[n_input_moves++] = move;
+    }
+}
+
+/* Queues the moves placing the falling block where the autoplayer finds best, unless a key was pressed since the last
+ * tick, in which case the player's moves go first, or a block was placed less than AUTOPLAY_NSEC ago. Searches take from
+ * well under a tick to a few hundred ms, depending on the depth, hence run on the autoplayer's thread (see
+ * autoplay_search): a search is requested on a snapshot of the game, and its plan queued on a later tick, once found,
+ * if it still holds by then (see autoplay_plan_valid).
+ */
+void autoplay(){
+    long long now = now_nsec();
+
+    pthread_mutex_lock(&autoplayMutex);
+    if(autoplay_state == AUTOPLAY_DONE){
+        if(autoplay_found && n_input_moves == 0 && autoplay_plan_valid()){
+            for(int i = 0; i < autoplay_plan.n_moves; i++){
+                queue_move(autoplay_plan.moves[i]);
+            }
+            next_autoplay_nsec = now + AUTOPLAY_NSEC;
+        }
+        autoplay_state = AUTOPLAY_IDLE;
+    }
+
+    if(autoplay_state == AUTOPLAY_IDLE && n_input_moves == 0 && now >= next_autoplay_nsec){
+        size_t size = tg_snapshot_size(tg);
+        if(size > autoplay_snapshot_size){
+            free(autoplay_snapshot);
+            autoplay_snapshot = malloc(size);
+            autoplay_snapshot_size = autoplay_snapshot != NULL ? size : 0;
+        }
+        if(autoplay_snapshot != NULL){
+            autoplay_snapshot_len = tg_save(tg, autoplay_snapshot, size);
+            autoplay_rows = tg->rows;
+            autoplay_cols = tg->cols;
+            autoplay_state = AUTOPLAY_REQUESTED;
+            pthread_cond_signal(&autoplayCond);
+        }
+    }
+    pthread_mutex_unlock(&autoplayMutex);
+}
+
+/* Whether the plan found by the autoplayer still takes the falling block where it was meant to go, the game having
+ * moved on since the search was requested: the plan, bar its final drop, is tried out on a copy of the game, which must
+ * then drop the block onto the cells of the plan's target. Called by autoplay, with autoplayMutex held.
+ */
+int autoplay_plan_valid(){
+    size_t size = tg_snapshot_size(tg);
+    if(size > autoplay_snapshot_size || autoplay_check == NULL){
+        return 0;
+    }
+
+    tg_save(tg, autoplay_snapshot, size);
+    if(!tg_load(autoplay_check, autoplay_snapshot, size)){
+        return 0;
+    }
+    tg_tick_moves(autoplay_check, autoplay_plan.moves, autoplay_plan.n_moves - 1);
+
+    tetris_block ghost = tg_ghost(autoplay_check), target = autoplay_plan.target;
+    const tetris_shape* ghost_shape = &TETROMINO_SHAPES[ghost.typ][ghost.ori];
+    const tetris_shape* target_shape = &TETROMINO_SHAPES[target.typ][target.ori];
+    return ghost.typ == target.typ && ghost.loc.row + ghost_shape->top == target.loc.row + target_shape->top
+           && ghost.loc.col + ghost_shape->left == target.loc.col + target_shape->left
+           && memcmp(ghost_shape->rows, target_shape->rows, sizeof(ghost_shape->rows)) == 0;
+}
+
+/* Runs the autoplayer's searches, each on the latest snapshot handed over by autoplay, loaded into a game of its own,
+ * until asked to stop.
+ */
+void* autoplay_search(void* arg){
+    tetris_game* game = NULL;
+    tetris_plan plan = {{TM_NONE}};
+
+    pthread_mutex_lock(&autoplayMutex);
+    while(1){
+        while(!autoplay_stop && autoplay_state != AUTOPLAY_REQUESTED){
+            pthread_cond_wait(&autoplayCond, &autoplayMutex);
+        }
+        if(autoplay_stop){
+            break;
+        }
+        pthread_mutex_unlock(&autoplayMutex); // the snapshot is left alone by the main thread until the search is done
+
+        if(game != NULL && (game->rows != autoplay_rows || game->cols != autoplay_cols)){
+            tg_delete(game);
+            game = NULL;
+        }
+        if(game == NULL){
+            game = tg_create(autoplay_rows, autoplay_cols, 0);
+        }
+        int found = game != NULL && tg_load(game, autoplay_snapshot, autoplay_snapshot_len)
+                    && tg_search_plan(autoplayer, game, &plan);
+
+        pthread_mutex_lock(&autoplayMutex);
+        autoplay_found = found;
+        autoplay_plan = plan;
+        autoplay_state = AUTOPLAY_DONE;
+    }
+    pthread_mutex_unlock(&autoplayMutex);
+
+    if(game != NULL){
+        tg_delete(game);
+    }
+    return NULL;
+}
+
+/* Handles a press of left or right. A terminal only reports keys being pressed, hence a key is taken to be held when the
+ * terminal repeats it: the first repeat comes within KEY_DELAY_NSEC of the press, and later ones within KEY_REPEAT_NSEC
+ * of each other. The press and the first repeat, which might as well be a second press, each move the block; from the
+ * second repeat on, the key is known to be held, and auto_shift moves the block instead, at the pace set by das_ms and
+ * arr_ms rather than by the terminal's key repeat.
+ */
+void press_shift(tetris_move move, long long now){
+    long long gap = now - shift.last_nsec;
+
+    if(shift.move == move && gap <= (shift.repeats == 0 ? KEY_DELAY_NSEC : KEY_REPEAT_NSEC)){ // repeated
+        shift.repeats++;
+        shift.interval_nsec = gap;
+        if(shift.repeats == 1){
+            queue_move(move);
+        }else if(shift.repeats == 2 && shift.next_shift_nsec < now){ // held for longer than das_ms already
+            shift.next_shift_nsec = now;
+        }
+    }else{ // pressed
+        shift.move = move;
+        shift.next_shift_nsec = now + das_ms * 1000000LL;
+        shift.repeats = 0;
+        queue_move(move);
+    }
+
+    shift.last_nsec = now;
+}
+
+/* Queues the auto-shift moves due while left or right is held. The key is only known to be held up to its last repeat,
+ * and taken to still be held for one more interval between repeats; the block is not moved past that, so that it does
+ * not overshoot when the key is released. With an arr_ms of 0, the block moves all the way to the wall at once.
+ */
+void auto_shift(long long now){
+    if(shift.move == TM_NONE || shift.repeats < 2){
+        return;
+    }
+
+    long long held_until = shift.last_nsec + shift.interval_nsec;
+    if(now > held_until){
+        now = held_until;
+    }
+
+    while(shift.next_shift_nsec <= now && n_input_moves < TG_MAX_MOVES){
+        if(arr_ms == 0){
+            for(int i = 0; i < tg->cols; i++){
+                queue_move(shift.move);
+            }
+            shift.next_shift_nsec = now + KEY_REPEAT_NSEC; // and keep it against the wall while held
+        }else{
+            queue_move(shift.move);
+            shift.next_shift_nsec += arr_ms * 1000000LL;
+        }
+    }
 }
 
 /* Cleanup function for the end of a game session, responsible for terminating any initiated threads, restoring NCURSES
  * behaviour as before for chatting, etc...
  */
 void game_cleanup(){
-    // cleanup ncurses windows used during game play
-    wclear(board); wrefresh(board);
-    wclear(next); wrefresh(next);
-    wclear(hold); wrefresh(hold);
-    wclear(score); wrefresh(score);
+    if(!headless){
+        // cleanup ncurses windows used during game play
+        werase(board); stage_window(board);
+        werase(next); stage_window(next);
+        werase(hold); stage_window(hold);
+        werase(score); stage_window(score);
+    }else{ // or report the final state of the game, and its end
+        emit_frame();
+        fprintf(headless_out, "E %d %d\n", tg->points, gameSession.total_lines_cleared);
+        screen_dirty = 1;
+    }
 
-    pthread_cancel(score_update_thread); // cancel the score update thread
+    if(recorder != NULL){ // finish the replay of the game, if recorded
+        tr_record_close(recorder);
+        recorder = NULL;
+    }
+
+    if(autoplay_check != NULL){ // the autoplayer's copy of the game, see autoplay_plan_valid
+        tg_delete(autoplay_check);
+        autoplay_check = NULL;
+    }
+
+    // stop the score update thread, once it sent the final score of the game
+    pthread_mutex_lock(&scoreMutex);
+    score_stop = 1;
+    pthread_cond_signal(&scoreCond);
+    pthread_mutex_unlock(&scoreMutex);
 
     if(pthread_join(score_update_thread, NULL) != 0){ // and wait to join thread
         curses_cleanup(); // call ncurses clean up function on failure
@@ -422,39 +1429,60 @@ void game_cleanup(){
         }
     }
 
-    //NCURSES reset to original state:
-    keypad(chat_box, FALSE);
+    // show the chat box as before the game
+    if(!headless){
+        display_chat_input();
+    }
+}
 
-    // Clear chat box of any garbage characters
-    wmove(chat_box, 0, 0);
-    wrefresh(chat_box);
+// Hands the current score of the game to the score update thread, waking it up only if the score changed. Only called
+// by the main thread, the only one writing score_latest, hence it may be read here without locking.
+void publish_score(int points){
+    if(points != score_latest){
+        pthread_mutex_lock(&scoreMutex);
+        score_latest = points;
+        score_changed = 1;
+        pthread_cond_signal(&scoreCond);
+        pthread_mutex_unlock(&scoreMutex);
+    }
 }
 
-// Periodically sends, in a thread--safe manner, the player's score to the server.
+/* Sends, in a thread--safe manner, the player's score to the server whenever it changes, at most once every
+ * score_interval_ms: changes made in between are coalesced into the next update. When asked to stop by game_cleanup,
+ * the latest score is flushed straight away, and the thread exits.
+ */
 void* score_update(void* arg){
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
-    while(1){ // until pthread_cancel called on the thread instance
-        sleep(1);
-
-        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-        int score = get_score(); // get score in a thread-safe manner using the library provided getter
+    char score_buf[SCORE_MSG_SIZE]; // reused by every update
+    msg score_msg;
+    score_msg.msg_type = SCORE_UPDATE;
+    score_msg.msg = score_buf;
+
+    long long next_send_nsec = 0;
+    int failed = 0;
+
+    pthread_mutex_lock(&scoreMutex);
+    while(!failed){
+        while(!score_changed && !score_stop){ // sleep until there is a score to send...
+            pthread_cond_wait(&scoreCond, &scoreMutex);
+        }
 
-        if(score < 0){ // if score is invalid...
+        if(!score_changed){ // ...or until asked to stop, with nothing left to send
             break;
         }
 
-        // prepare message for sending score update to the server...
-        msg score_msg;
-        score_msg.msg_type = SCORE_UPDATE;
-
-        score_msg.msg = malloc(7); // allocate enough memory in the data part
-        if(score_msg.msg == NULL){
-            mrerror("Failed to allocate memory for score update to server");
+        while(!score_stop && now_nsec() < next_send_nsec){ // and keep to the interval, unless flushing the final score
+            struct timespec deadline = {next_send_nsec / 1000000000LL, next_send_nsec % 1000000000LL};
+            pthread_cond_timedwait(&scoreCond, &scoreMutex, &deadline);
         }
-        sprintf(score_msg.msg, "%d", score); // and cast the score from int to string
 
-        if(send_msg(score_msg, server_fd) < 0){ // then attempt to send to the server...
+        int score = score_latest;
+        score_changed = 0;
+        pthread_mutex_unlock(&scoreMutex);
+
+        snprintf(score_buf, sizeof(score_buf), "%d", score); // cast the score from int to string
+        next_send_nsec = now_nsec() + score_interval_ms * 1000000LL;
+
+        if(send_server_msg(score_msg) < 0){ // then attempt to send to the server...
             signalGameTermination(); // if failed, in a thread safe manner change in_game flag to 0...
 
             // in a thread--safe manner change the flags which indicate whether an error has occurred while communicating
@@ -464,19 +1492,22 @@ void* score_update(void* arg){
             server_err = 1;
             pthread_mutex_unlock(&serverConnectionMutex);
 
-            break;
+            failed = 1;
         }
 
-        free(score_msg.msg); // free memory as necessary
-
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        pthread_mutex_lock(&scoreMutex);
     }
+    pthread_mutex_unlock(&scoreMutex);
 
     pthread_exit(NULL);
 }
 
-// Simple NCURSES clean up function that restores the terminal back to its original state
+// Simple NCURSES clean up function that restores the terminal back to its original state; nothing to do when headless
 void curses_cleanup(){
+    if(headless){
+        return;
+    }
+
     delwin(live_chat);
     delwin(chat_box);
     delwin(live_chat_border);
@@ -485,6 +1516,9 @@ void curses_cleanup(){
     delwin(next);
     delwin(hold);
     delwin(score);
+    if(debug_win != NULL){
+        delwin(debug_win);
+    }
 
     clear();
     endwin();
@@ -502,6 +1536,8 @@ void curses_cleanup(){
  * (iii) int main(int argc, char **argv); [the main game logic is implemented in
  *       void* start_game(void* arg) along with the required multi-threading and
  *       peer-to-peer logic]
+ * (iv)  void sleep_milli(int milliseconds); [replaced by the fixed timestep
+ *       scheduler, see now_nsec and wait_for_events]
  *
  * The original copyright is stated below, see StephenBrennan_Tetris_LICENSE.txt
  * for further details:
@@ -509,39 +1545,85 @@ void curses_cleanup(){
  * Copyright (c) 2015, Stephen Brennan.  Released under the Revised BSD License.
  ******************************************************************************/
 
-void sleep_milli(int milliseconds){
+// Current time on the monotonic clock, in nanoseconds
+long long now_nsec(void){
     struct timespec ts;
-    ts.tv_sec = 0;
-    ts.tv_nsec = milliseconds * 1000 * 1000;
-    nanosleep(&ts, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-// Print the tetris board onto the ncurses window.
-void display_board(WINDOW *w, tetris_game *obj){
-    int i, j;
-    wborder(w, '|', '|', '-', '-', '+', '+', '+', '+');
+/* Sleep until there is keyboard input on stdin, or commands on input_fd in headless mode, the server message thread
+ * signals msg_event_fd, or the monotonic clock reaches deadline (in nanoseconds; -1 to wait indefinitely), whichever
+ * comes first. Returns straight away if the deadline has already passed. Hence an idle client uses no CPU, yet reacts
+ * to input and messages straight away.
+ */
+void wait_for_events(long long deadline){
+    struct pollfd fds[2] = {{input_fd, POLLIN, 0}, {msg_event_fd, POLLIN, 0}};
+    struct timespec ts, *timeout = NULL;
+    uint64_t count;
+
+    if(deadline >= 0){
+        long long remaining = deadline - now_nsec();
+        if(remaining <= 0){
+            return;
+        }
+
+        ts.tv_sec = remaining / 1000000000LL;
+        ts.tv_nsec = remaining % 1000000000LL;
+        timeout = &ts;
+    }
+
+    if(ppoll(fds, 2, timeout, NULL) > 0 && (fds[1].revents & POLLIN)){
+        // reset the counter; the main loop then handles messages until the inbox is empty before waiting again
+        if(read(msg_event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN){
+            return;
+        }
+    }
+}
+
+/* Print the tetris board onto the ncurses window.
+ * @xandru: only the rows which the engine marked dirty are redrawn, each with a single call; the border is drawn once,
+ * by start_game. Returns 1 if anything was redrawn, 0 otherwise.
+ */
+int display_board(WINDOW *w, tetris_game *obj){
+    int i, j, k, drawn = 0;
+    char cell;
+    chtype line[COLS_PER_CELL * TG_MAX_COLS];
     for (i = 0; i < obj->rows; i++) {
-        wmove(w, 1 + i, 1);
+        if (!tg_row_dirty(obj, i)) {
+            continue;
+        }
         for (j = 0; j < obj->cols; j++) {
-            if (TC_IS_FILLED(tg_get(obj, i, j))) {
-                ADD_BLOCK(w,tg_get(obj, i, j));
-            } else {
-                ADD_EMPTY(w);
+            cell = tg_get(obj, i, j);
+            for (k = 0; k < COLS_PER_CELL; k++) {
+                line[j * COLS_PER_CELL + k] = TC_IS_FILLED(cell) ? ' '|A_REVERSE|COLOR_PAIR(cell) : ' ';
             }
         }
+        mvwaddchnstr(w, 1 + i, 1, line, COLS_PER_CELL * obj->cols);
+        drawn = 1;
     }
-    wnoutrefresh(w);
+    tg_clear_dirty(obj);
+    if (drawn) {
+        wnoutrefresh(w);
+    }
+    return drawn;
 }
 
-// Display a tetris piece in a dedicated window.
-void display_piece(WINDOW *w, tetris_block block){
+/* Display a tetris piece in a dedicated window.
+ * @xandru: only redrawn if it differs from *shown, the piece last drawn in the window. Returns 1 if redrawn.
+ */
+int display_piece(WINDOW *w, tetris_block block, tetris_block *shown){
     int b;
     tetris_location c;
-    wclear(w);
+    if (block.typ == shown->typ && (block.typ == -1 || block.ori == shown->ori)) {
+        return 0;
+    }
+    *shown = block;
+    werase(w); // @xandru: rather than wclear, which repaints the whole screen
     wborder(w, '|', '|', '-', '-', '+', '+', '+', '+');
     if (block.typ == -1) {
         wnoutrefresh(w);
-        return;
+        return 1;
     }
     for (b = 0; b < TETRIS; b++) {
         c = TETROMINOS[block.typ][block.ori][b];
@@ -549,15 +1631,25 @@ void display_piece(WINDOW *w, tetris_block block){
         ADD_BLOCK(w, TYPE_TO_CELL(block.typ));
     }
     wnoutrefresh(w);
+    return 1;
 }
 
-// Display score information in a dedicated window.
-void display_score(WINDOW *w, tetris_game *tg){
-    wclear(w);
+/* Display score information in a dedicated window.
+ * @xandru: only redrawn when the score, level or lines remaining change. Returns 1 if redrawn.
+ */
+int display_score(WINDOW *w, tetris_game *tg){
+    if (tg->points == points_shown && tg->level == level_shown && tg->lines_remaining == lines_shown) {
+        return 0;
+    }
+    points_shown = tg->points;
+    level_shown = tg->level;
+    lines_shown = tg->lines_remaining;
+    werase(w);
     wprintw(w, "Score\n%d\n", tg->points);
     wprintw(w, "Level\n%d\n", tg->level);
     wprintw(w, "Lines\n%d\n", tg->lines_remaining);
     wnoutrefresh(w);
+    return 1;
 }
 
 // Do the NCURSES initialization steps for color blocks.
@@ -571,4 +1663,5 @@ void init_colors(void){
     init_pair(TC_CELLS, COLOR_GREEN, COLOR_BLACK);
     init_pair(TC_CELLT, COLOR_MAGENTA, COLOR_BLACK);
     init_pair(TC_CELLZ, COLOR_RED, COLOR_BLACK);
+    init_pair(TC_GARBAGE, COLOR_WHITE, COLOR_BLACK); // @xandru: garbage lines from other players
 }
@@ -0,0 +1,146 @@
+/***************************************************************************//**
+ * Metrics: log-linear histograms and atomic counters, see metrics.h.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics.h"
+
+/*
+  Bucket of a value: values below 4 have a bucket each, and every power of two
+  above is split into four buckets by the two bits below its leading bit.
+ */
+static int mt_bucket(uint64_t value)
+{
+  int msb;
+
+  if (value < 4) {
+    return (int) value;
+  }
+  msb = 63 - __builtin_clzll(value);
+  return 4 * (msb - 1) + (int) ((value >> (msb - 2)) & 3);
+}
+
+/*
+  Smallest value in a bucket.
+ */
+static uint64_t mt_bucket_low(int bucket)
+{
+  if (bucket < 4) {
+    return (uint64_t) bucket;
+  }
+  return (uint64_t) (4 + bucket % 4) << (bucket / 4 - 1);
+}
+
+void mt_record(metric_hist *hist, uint64_t value)
+{
+  hist->counts[mt_bucket(value)]++;
+  hist->period_count++;
+  hist->count++;
+  hist->sum += value;
+}
+
+/*
+  The q-quantile of the samples of the current period, as the middle of the
+  bucket holding it, or 0 if there are none.
+ */
+uint64_t mt_quantile(const metric_hist *hist, double q)
+{
+  uint64_t rank = (uint64_t) (q * hist->period_count), seen = 0, low, high;
+  int b;
+
+  if (hist->period_count == 0) {
+    return 0;
+  }
+  if (rank >= hist->period_count) {
+    rank = hist->period_count - 1;
+  }
+  for (b = 0; b < MT_BUCKETS - 1; b++) {
+    seen += hist->counts[b];
+    if (seen > rank) {
+      break;
+    }
+  }
+  low = mt_bucket_low(b);
+  high = b < MT_BUCKETS - 1 ? mt_bucket_low(b + 1) : UINT64_MAX;
+  return low + (high - low) / 2;
+}
+
+/*
+  End the current period: keep its p50 and p99, and start a new one.  Periods
+  without samples keep the quantiles of the last period which had some.
+ */
+void mt_roll(metric_hist *hist)
+{
+  if (hist->period_count > 0) {
+    hist->p50 = mt_quantile(hist, 0.5);
+    hist->p99 = mt_quantile(hist, 0.99);
+  }
+  memset(hist->counts, 0, sizeof(hist->counts));
+  hist->period_count = 0;
+}
+
+/*
+  Add the samples of another histogram, those of its current period to the
+  current period, e.g. to combine histograms recorded by several threads.
+ */
+void mt_merge(metric_hist *into, const metric_hist *from)
+{
+  int b;
+
+  for (b = 0; b < MT_BUCKETS; b++) {
+    into->counts[b] += from->counts[b];
+  }
+  into->period_count += from->period_count;
+  into->count += from->count;
+  into->sum += from->sum;
+}
+
+void mt_add(metric_counter *counter, uint64_t n)
+{
+  __atomic_fetch_add(&counter->value, n, __ATOMIC_RELAXED);
+}
+
+uint64_t mt_read(const metric_counter *counter)
+{
+  return __atomic_load_n(&counter->value, __ATOMIC_RELAXED);
+}
+
+/*
+  Write out all metrics in the Prometheus text format, histograms as summaries
+  with their last p50 and p99.  The file is written next to path and renamed
+  over it, so that readers never see it half written.  Returns false if it
+  could not be written.
+ */
+bool mt_export(const char *path, const metric_hist *hists, int n_hists,
+               const metric_counter *counters, int n_counters)
+{
+  char tmp[4096];
+  FILE *f;
+  int i;
+  bool ok;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp) ||
+      (f = fopen(tmp, "w")) == NULL) {
+    return false;
+  }
+
+  for (i = 0; i < n_hists; i++) {
+    const metric_hist *h = &hists[i];
+    fprintf(f, "# HELP %s %s\n# TYPE %s summary\n", h->name, h->help, h->name);
+    fprintf(f, "%s{quantile=\"0.5\"} %.9g\n", h->name, h->p50 / h->scale);
+    fprintf(f, "%s{quantile=\"0.99\"} %.9g\n", h->name, h->p99 / h->scale);
+    fprintf(f, "%s_sum %.9g\n", h->name, h->sum / h->scale);
+    fprintf(f, "%s_count %llu\n", h->name, (unsigned long long) h->count);
+  }
+  for (i = 0; i < n_counters; i++) {
+    const metric_counter *c = &counters[i];
+    fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", c->name, c->help, c->name);
+    fprintf(f, "%s %llu\n", c->name, (unsigned long long) mt_read(c));
+  }
+
+  ok = !ferror(f);
+  ok = fclose(f) == 0 && ok;
+  return ok && rename(tmp, path) == 0;
+}
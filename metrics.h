@@ -0,0 +1,56 @@
+/***************************************************************************//**
+ * Metrics: histograms and counters for instrumenting the front-end, with a
+ * Prometheus style text export.
+ *
+ * A histogram counts its samples in log-linear buckets: four per power of two,
+ * hence quantiles are within 25% of the true value, and recording a sample is
+ * a handful of instructions with no allocation.  Histograms are meant to be
+ * recorded to, rolled and read by a single thread.  Quantiles are taken over
+ * periods: mt_roll computes the p50 and p99 of the samples recorded since the
+ * last roll, and starts a new period.  Counts and sums run since the start.
+ *
+ * Counters are updated atomically, hence may be added to from any thread.
+ ******************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+  Number of buckets: one for each value below 4, then four per power of two,
+  for any 64 bit value.
+ */
+#define MT_BUCKETS (4 + 4 * 62)
+
+typedef struct {
+  const char *name;  // exported as a summary of that name
+  const char *help;
+  double scale;      // exported values are divided by scale, e.g. 1e9 for ns
+  uint64_t counts[MT_BUCKETS];  // samples of the current period
+  uint64_t period_count;
+  uint64_t count;  // samples since the start, and their sum
+  uint64_t sum;
+  uint64_t p50;    // quantiles of the last period
+  uint64_t p99;
+} metric_hist;
+
+typedef struct {
+  const char *name;  // exported as a counter of that name
+  const char *help;
+  uint64_t value;
+} metric_counter;
+
+void mt_record(metric_hist *hist, uint64_t value);
+uint64_t mt_quantile(const metric_hist *hist, double q);
+void mt_roll(metric_hist *hist);
+void mt_merge(metric_hist *into, const metric_hist *from);
+
+void mt_add(metric_counter *counter, uint64_t n);
+uint64_t mt_read(const metric_counter *counter);
+
+bool mt_export(const char *path, const metric_hist *hists, int n_hists,
+               const metric_counter *counters, int n_counters);
+
+#endif // METRICS_H
@@ -0,0 +1,472 @@
+/***************************************************************************//**
+ * Mock of the client library, see mock/client_server.h.
+ *
+ * The mock server plays a script, one command per line; empty lines and lines
+ * starting with # are skipped:
+ *   latency <ms> [jitter_ms]  delay the messages sent from then on by ms, plus
+ *                             up to jitter_ms at random; they are still
+ *                             received in the order they were sent
+ *   chat <count> <per_sec> [text]
+ *                             send count chat messages, per_sec every second,
+ *                             or all at once if 0; each starts with the time it
+ *                             was sent, in ns on the monotonic clock, in []
+ *   game <type> [seed [time [baselines [winlines]]]]
+ *                             send NEW_GAME, for a game of type chill,
+ *                             rising_tide, fast_track or boomer, then
+ *                             START_GAME once the front-end handled it
+ *   garbage <lines>           lines added by the next get_lines_to_add
+ *   wait <ms>
+ *   wait_end                  wait until the front-end ends its game
+ *   repeat                    start the script over
+ *   disconnect                disconnect, hence the front-end exits
+ * Chat messages sent by the front-end are echoed back, as by the server, in
+ * the same format as the scripted ones.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "client_server.h"
+
+// Longest text of a message, and of a line of the script, and the most lines in a script
+#define MOCK_MSG_LEN 128
+#define MOCK_LINE_LEN 256
+#define MOCK_SCRIPT_LINES 256
+
+// Longest enqueue_server_msg waits for a message, as the time-out of the library's select call
+#define MOCK_POLL_NSEC 100000000LL
+
+// Defaults of the game command
+#define MOCK_GAME_TIME 2
+#define MOCK_GAME_BASELINES 5
+#define MOCK_GAME_WINLINES 10
+
+// GLOBALS
+
+game_session gameSession;
+int server_fd = -1;
+
+// A script command, see above
+enum {OP_LATENCY, OP_CHAT, OP_GAME, OP_GARBAGE, OP_WAIT, OP_WAIT_END, OP_REPEAT, OP_DISCONNECT};
+typedef struct{
+    int op;
+    long args[5];
+    int n_args; // how many of args the line gave, the rest being defaults
+    char text[MOCK_MSG_LEN];
+} mock_command;
+
+static mock_command script[MOCK_SCRIPT_LINES];
+static int n_script = 0;
+static const char* default_script[] = {"chat 10 20 hello from the mock server", "game chill", "wait_end", "repeat"};
+
+// The wire: messages sent by the mock server, each received by enqueue_server_msg once its delivery time came, in a
+// ring of MOCK_SLOTS which also holds the data of the messages received, until overwritten. Messages are sent with the
+// latency and jitter of the script, the latter drawn from jitter_seed, as are the seeds of games the script gives none.
+// All guarded by wireMutex, with wireCond
+// signalled whenever a message is sent or received.
+typedef struct{
+    int msg_type;
+    long long deliver_nsec;
+    char text[MOCK_MSG_LEN];
+} mock_msg;
+
+static mock_msg wire[MOCK_SLOTS];
+static unsigned long wire_head = 0, wire_tail = 0; // next message to receive, and to send
+static long long latency_nsec = 0, jitter_nsec = 0, last_deliver_nsec = 0;
+static unsigned int jitter_seed;
+static pthread_mutex_t wireMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wireCond;
+
+// The library's queue of received messages, see dequeue_server_msg
+static msg queue[MOCK_SLOTS];
+static unsigned long queue_head = 0, queue_tail = 0;
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Progress of the game, as seen by the mock server: whether the front-end handled NEW_GAME, and whether it ended the
+// game since; guarded by gameMutex, with changes signalled through gameCond
+static int game_ready = 0, game_ended = 0;
+static pthread_mutex_t gameMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gameCond = PTHREAD_COND_INITIALIZER;
+
+// Garbage lines for get_lines_to_add, and the score last set; accessed atomically
+static int lines_to_add = 0, score = 0;
+
+// FUNC DEFNS
+
+static long long mock_now();
+static void mock_sleep_until(long long deadline);
+static int mock_parse(const char* line, mock_command* cmd);
+static void mock_add_line(const char* line, int n);
+static void mock_load_script();
+static int mock_send(int msg_type, const char* text, int wait);
+static void* mock_server(void* arg);
+
+// Current time on the monotonic clock, in nanoseconds
+static long long mock_now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void mock_sleep_until(long long deadline){
+    struct timespec ts = {deadline / 1000000000LL, deadline % 1000000000LL};
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/* Parses a line of the script into cmd. Returns 1 if it is a command, 0 if it is to be skipped, or -1 if it is not
+ * valid.
+ */
+static int mock_parse(const char* line, mock_command* cmd){
+    static const char* game_types[] = {"rising_tide", "fast_track", "boomer", "chill"}; // in the order of GameType
+    char name[16], type[16];
+    int n = 0;
+
+    memset(cmd, 0, sizeof(*cmd));
+    if(sscanf(line, " %15s %n", name, &n) < 1 || name[0] == '#'){
+        return 0;
+    }
+    line += n;
+
+    if(strcmp(name, "latency") == 0){
+        cmd->op = OP_LATENCY;
+        return sscanf(line, "%ld %ld", &cmd->args[0], &cmd->args[1]) >= 1 ? 1 : -1;
+    }else if(strcmp(name, "chat") == 0){
+        cmd->op = OP_CHAT;
+        if(sscanf(line, "%ld %ld %n", &cmd->args[0], &cmd->args[1], &n) < 2){
+            return -1;
+        }
+        snprintf(cmd->text, sizeof(cmd->text), "%s", line[n] != '\0' ? line + n : "hello");
+        cmd->text[strcspn(cmd->text, "\r\n")] = '\0';
+        return 1;
+    }else if(strcmp(name, "game") == 0){
+        cmd->op = OP_GAME;
+        cmd->args[2] = MOCK_GAME_TIME;
+        cmd->args[3] = MOCK_GAME_BASELINES;
+        cmd->args[4] = MOCK_GAME_WINLINES;
+        cmd->n_args = sscanf(line, "%15s %ld %ld %ld %ld", type, &cmd->args[1], &cmd->args[2], &cmd->args[3],
+                             &cmd->args[4]);
+        if(cmd->n_args < 1){
+            return -1;
+        }
+        for(cmd->args[0] = 0; cmd->args[0] < 4; cmd->args[0]++){
+            if(strcmp(type, game_types[cmd->args[0]]) == 0){
+                return 1;
+            }
+        }
+        return -1;
+    }else if(strcmp(name, "garbage") == 0){
+        cmd->op = OP_GARBAGE;
+        return sscanf(line, "%ld", &cmd->args[0]) == 1 ? 1 : -1;
+    }else if(strcmp(name, "wait") == 0){
+        cmd->op = OP_WAIT;
+        return sscanf(line, "%ld", &cmd->args[0]) == 1 ? 1 : -1;
+    }else if(strcmp(name, "wait_end") == 0){
+        cmd->op = OP_WAIT_END;
+        return 1;
+    }else if(strcmp(name, "repeat") == 0){
+        cmd->op = OP_REPEAT;
+        return 1;
+    }else if(strcmp(name, "disconnect") == 0){
+        cmd->op = OP_DISCONNECT;
+        return 1;
+    }
+
+    return -1;
+}
+
+// Adds a line of the script, the n-th, exiting if it is not valid
+static void mock_add_line(const char* line, int n){
+    char err[MOCK_LINE_LEN + 64];
+    mock_command cmd;
+    int ret = mock_parse(line, &cmd);
+
+    if(ret < 0 || (ret > 0 && n_script == MOCK_SCRIPT_LINES)){
+        snprintf(err, sizeof(err), "Invalid command on line %d of the mock script: %s", n, line);
+        mrerror(err);
+    }else if(ret > 0){
+        script[n_script++] = cmd;
+    }
+}
+
+// Loads the script from the file named by TETRIS_MOCK_SCRIPT, or else the default one
+static void mock_load_script(){
+    char line[MOCK_LINE_LEN];
+    char* path = getenv("TETRIS_MOCK_SCRIPT");
+    int n = 0;
+
+    if(path == NULL){
+        for(n = 0; n < (int) (sizeof(default_script) / sizeof(default_script[0])); n++){
+            mock_add_line(default_script[n], n + 1);
+        }
+        return;
+    }
+
+    FILE* f = fopen(path, "r");
+    if(f == NULL){
+        mrerror("Cannot open the mock script");
+    }
+    while(fgets(line, sizeof(line), f) != NULL){
+        mock_add_line(line, ++n);
+    }
+    fclose(f);
+}
+
+/* Sends a message from the mock server, to be received once the latency, and any jitter, passed. If MOCK_WIRE_MAX
+ * messages are waiting to be received already, waits for room if wait is set, or otherwise drops the message. Returns 1
+ * if the message was sent.
+ */
+static int mock_send(int msg_type, const char* text, int wait){
+    pthread_mutex_lock(&wireMutex);
+
+    while(wire_tail - wire_head >= MOCK_WIRE_MAX){
+        if(!wait){
+            pthread_mutex_unlock(&wireMutex);
+            return 0;
+        }
+        pthread_cond_wait(&wireCond, &wireMutex);
+    }
+
+    long long deliver = mock_now() + latency_nsec;
+    if(jitter_nsec > 0){
+        deliver += (long long) ((double) rand_r(&jitter_seed) / RAND_MAX * jitter_nsec);
+    }
+    if(deliver < last_deliver_nsec){ // received in the order sent, as over a stream socket
+        deliver = last_deliver_nsec;
+    }
+
+    mock_msg* m = &wire[wire_tail % MOCK_SLOTS];
+    m->msg_type = msg_type;
+    m->deliver_nsec = last_deliver_nsec = deliver;
+    snprintf(m->text, sizeof(m->text), "%s", text);
+    wire_tail++;
+
+    pthread_cond_broadcast(&wireCond);
+    pthread_mutex_unlock(&wireMutex);
+    return 1;
+}
+
+// The mock server: plays the script, then stays connected doing nothing, unless it disconnected
+static void* mock_server(void* arg){
+    char text[2 * MOCK_MSG_LEN]; // truncated to MOCK_MSG_LEN by mock_send
+
+    for(int pc = 0; pc < n_script; pc++){
+        mock_command* cmd = &script[pc];
+
+        switch(cmd->op){
+            case OP_LATENCY: {
+                pthread_mutex_lock(&wireMutex);
+                latency_nsec = cmd->args[0] * 1000000LL;
+                jitter_nsec = cmd->args[1] * 1000000LL;
+                pthread_mutex_unlock(&wireMutex);
+            } break;
+            case OP_CHAT: {
+                long long start = mock_now();
+                for(long i = 0; i < cmd->args[0]; i++){
+                    if(cmd->args[1] > 0){
+                        mock_sleep_until(start + i * 1000000000LL / cmd->args[1]);
+                    }
+                    snprintf(text, sizeof(text), "[%lld] %s", mock_now(), cmd->text);
+                    mock_send(CHAT, text, 1);
+                }
+            } break;
+            case OP_GAME: {
+                long seed = cmd->args[1];
+
+                if(cmd->n_args < 2){ // drawn anew every time, so that every game of a repeated script differs
+                    pthread_mutex_lock(&wireMutex);
+                    seed = rand_r(&jitter_seed);
+                    pthread_mutex_unlock(&wireMutex);
+                }
+
+                pthread_mutex_lock(&gameMutex);
+                game_ready = game_ended = 0;
+                pthread_mutex_unlock(&gameMutex);
+
+                // as the server's invite, with no peers
+                snprintf(text, sizeof(text), "%ld::%ld::%ld::%ld::%ld::0::127.0.0.1", cmd->args[0], cmd->args[3],
+                         cmd->args[4], cmd->args[2], seed);
+                mock_send(NEW_GAME, text, 1);
+
+                pthread_mutex_lock(&gameMutex);
+                while(!game_ready){
+                    pthread_cond_wait(&gameCond, &gameMutex);
+                }
+                pthread_mutex_unlock(&gameMutex);
+
+                mock_send(START_GAME, "", 1);
+            } break;
+            case OP_GARBAGE: __atomic_fetch_add(&lines_to_add, (int) cmd->args[0], __ATOMIC_RELAXED); break;
+            case OP_WAIT: mock_sleep_until(mock_now() + cmd->args[0] * 1000000LL); break;
+            case OP_WAIT_END: {
+                pthread_mutex_lock(&gameMutex);
+                while(!game_ended){
+                    pthread_cond_wait(&gameCond, &gameMutex);
+                }
+                pthread_mutex_unlock(&gameMutex);
+            } break;
+            case OP_REPEAT: pc = -1; break;
+            case OP_DISCONNECT: mock_send(INVALID, "", 1); return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/* Loads the script, and starts the mock server; server_fd is then open, on /dev/null, for the front-end to check and
+ * pass around as it would the socket to the server. The server's address is ignored.
+ */
+void client_init(char* server_ip){
+    pthread_condattr_t attr;
+    pthread_t server_thread;
+
+    jitter_seed = (unsigned int) getpid();
+    mock_load_script();
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wireCond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    server_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if(server_fd >= 0 && pthread_create(&server_thread, NULL, mock_server, NULL) != 0){
+        close(server_fd);
+        server_fd = -1;
+    }else if(server_fd >= 0){
+        pthread_detach(server_thread);
+    }
+}
+
+// Error functions as the library's: both print the error, and mrerror exits
+void mrerror(char* err_msg){
+    fprintf(stderr, "%s\n", err_msg);
+    exit(EXIT_FAILURE);
+}
+
+void smrerror(char* err_msg){
+    fprintf(stderr, "%s\n", err_msg);
+}
+
+/* Receives the next message sent by the mock server, once its delivery time came, and adds it to the library's queue.
+ * If there is none within MOCK_POLL_NSEC, a message of type EMPTY is returned, as on a time-out of the library.
+ */
+msg enqueue_server_msg(int fd){
+    long long deadline = mock_now() + MOCK_POLL_NSEC;
+    msg recv_msg = {EMPTY, NULL};
+
+    pthread_mutex_lock(&wireMutex);
+    while(1){
+        long long now = mock_now(), wake = deadline;
+
+        if(wire_head < wire_tail){
+            mock_msg* m = &wire[wire_head % MOCK_SLOTS];
+            if(m->deliver_nsec <= now){
+                recv_msg.msg_type = m->msg_type;
+                recv_msg.msg = m->text;
+                wire_head++;
+                pthread_cond_broadcast(&wireCond); // room for the server to send more
+                break;
+            }else if(m->deliver_nsec < wake){
+                wake = m->deliver_nsec;
+            }
+        }
+
+        if(now >= deadline){
+            break;
+        }
+
+        struct timespec ts = {wake / 1000000000LL, wake % 1000000000LL};
+        pthread_cond_timedwait(&wireCond, &wireMutex, &ts);
+    }
+    pthread_mutex_unlock(&wireMutex);
+
+    if(recv_msg.msg_type != EMPTY && recv_msg.msg_type != INVALID){
+        pthread_mutex_lock(&queueMutex);
+        if(queue_tail - queue_head == MOCK_SLOTS){ // never the case with the front-end, which keeps it near empty
+            queue_head++;
+        }
+        queue[queue_tail++ % MOCK_SLOTS] = recv_msg;
+        pthread_mutex_unlock(&queueMutex);
+    }
+
+    return recv_msg;
+}
+
+// Takes the oldest message off the library's queue, or returns a message of type EMPTY if there is none
+msg dequeue_server_msg(){
+    msg recv_msg = {EMPTY, NULL};
+
+    pthread_mutex_lock(&queueMutex);
+    if(queue_head < queue_tail){
+        recv_msg = queue[queue_head++ % MOCK_SLOTS];
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    return recv_msg;
+}
+
+/* Sends a message to the mock server, which echoes chat messages back, and returns the number of bytes of data sent.
+ * The echo is dropped, rather than waited for, if the wire is full, since the front-end may be busy elsewhere.
+ */
+int send_msg(msg send_msg, int socket_fd){
+    if(send_msg.msg_type == CHAT){
+        char text[MOCK_MSG_LEN]; // truncated as it would be by mock_send
+        snprintf(text, sizeof(text), "[%lld] you: %s", mock_now(), send_msg.msg);
+        mock_send(CHAT, text, 0);
+    }
+
+    return (int) strlen(send_msg.msg) + 1;
+}
+
+// Sets up the game session from the data of a NEW_GAME message, and tells the mock server the game is ready to start
+void handle_new_game_msg(msg recv_msg){
+    sscanf(recv_msg.msg, "%d::%d::%d::%d::%d", &gameSession.game_type, &gameSession.n_baselines,
+           &gameSession.n_winlines, &gameSession.time, &gameSession.seed);
+    gameSession.start_time = time(NULL);
+    gameSession.total_lines_cleared = 0;
+
+    pthread_mutex_lock(&gameMutex);
+    game_ready = 1;
+    pthread_cond_broadcast(&gameCond);
+    pthread_mutex_unlock(&gameMutex);
+}
+
+// There are no peers: these threads have nothing to do
+void* accept_peer_connections(void* arg){
+    return NULL;
+}
+
+void* service_peer_connections(void* arg){
+    return NULL;
+}
+
+// Garbage lines given by the script since the last call
+int get_lines_to_add(){
+    return __atomic_exchange_n(&lines_to_add, 0, __ATOMIC_RELAXED);
+}
+
+void send_cleared_lines(int n){
+}
+
+void set_score(int new_score){
+    __atomic_store_n(&score, new_score, __ATOMIC_RELAXED);
+}
+
+int get_score(){
+    return __atomic_load_n(&score, __ATOMIC_RELAXED);
+}
+
+int signalGameTermination(){
+    return 0;
+}
+
+// Ends the game, as far as the mock server is concerned
+int end_game(){
+    pthread_mutex_lock(&gameMutex);
+    game_ended = 1;
+    pthread_cond_broadcast(&gameCond);
+    pthread_mutex_unlock(&gameMutex);
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+/***************************************************************************//**
+ * Mock of the client library (https://github.com/xmif1/CPS2008_Tetris_Client),
+ * for running the front-end with no server or network, e.g. many sessions at
+ * once under the load generator (see loadgen.c).
+ *
+ * The interface is that of the library's client_server.h, as far as the
+ * front-end uses it. Behind it, the "server" is a thread of the same process,
+ * playing a script of CHAT, NEW_GAME and START_GAME messages with a given
+ * latency and rate (see mock/client_server.c for the script format). The
+ * script is read from the file named by TETRIS_MOCK_SCRIPT, if set.
+ *
+ * Unlike with the library, the data of received messages is owned by the mock,
+ * and stays valid for at least MOCK_SLOTS - MOCK_WIRE_MAX more messages.
+ ******************************************************************************/
+
+#ifndef CLIENT_SERVER_H
+#define CLIENT_SERVER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Messages kept by the mock, and the most of these sent by the server but not yet received, beyond which the server
+// waits, as it would on a full socket
+#define MOCK_SLOTS 2048
+#define MOCK_WIRE_MAX 512
+
+// Message types, with the same values as the library's
+enum MsgType {INVALID = -2, EMPTY = -1, CHAT = 0, SCORE_UPDATE = 1, NEW_GAME = 2, FINISHED_GAME = 3, P2P_READY = 4,
+              CLIENTS_CONNECTED = 5, START_GAME = 6, LINES_CLEARED = 7};
+
+enum GameType {RISING_TIDE, FAST_TRACK, BOOMER, CHILL};
+
+typedef struct{
+    int msg_type;
+    char* msg;
+} msg;
+
+// The game session being played, set up from the NEW_GAME message by handle_new_game_msg
+typedef struct{
+    int game_type;
+    int n_baselines;
+    int n_winlines;
+    int time;
+    int seed;
+    time_t start_time;
+    int total_lines_cleared;
+} game_session;
+
+extern game_session gameSession;
+extern int server_fd;
+
+void client_init(char* server_ip);
+void mrerror(char* err_msg);
+void smrerror(char* err_msg);
+
+msg enqueue_server_msg(int server_fd);
+msg dequeue_server_msg();
+int send_msg(msg send_msg, int socket_fd);
+
+void handle_new_game_msg(msg recv_msg);
+void* accept_peer_connections(void* arg);
+void* service_peer_connections(void* arg);
+int get_lines_to_add();
+void send_cleared_lines(int n);
+void set_score(int score);
+int get_score();
+int signalGameTermination();
+int end_game();
+
+#endif // CLIENT_SERVER_H
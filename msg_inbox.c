@@ -0,0 +1,51 @@
+/***************************************************************************//**
+ * Message inbox: a lock-free SPSC queue of server messages, see msg_inbox.h.
+ ******************************************************************************/
+
+#include "msg_inbox.h"
+
+void mi_init(msg_inbox *inbox)
+{
+  inbox->head = 0;
+  inbox->tail = 0;
+}
+
+/*
+  Append a message, from the producer only.  Returns false if the inbox is
+  full.
+ */
+bool mi_push(msg_inbox *inbox, msg m)
+{
+  size_t tail = inbox->tail;
+
+  if (tail - __atomic_load_n(&inbox->head, __ATOMIC_ACQUIRE) == MI_CAPACITY) {
+    return false;
+  }
+  inbox->slots[tail & (MI_CAPACITY - 1)] = m;
+  __atomic_store_n(&inbox->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/*
+  Take the oldest message, from the consumer only.  Returns false if the inbox
+  is empty.
+ */
+bool mi_pop(msg_inbox *inbox, msg *m)
+{
+  size_t head = inbox->head;
+
+  if (__atomic_load_n(&inbox->tail, __ATOMIC_ACQUIRE) == head) {
+    return false;
+  }
+  *m = inbox->slots[head & (MI_CAPACITY - 1)];
+  __atomic_store_n(&inbox->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/*
+  Number of messages waiting, from the consumer only.
+ */
+size_t mi_depth(msg_inbox *inbox)
+{
+  return __atomic_load_n(&inbox->tail, __ATOMIC_ACQUIRE) - inbox->head;
+}
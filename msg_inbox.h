@@ -0,0 +1,42 @@
+/***************************************************************************//**
+ * Message inbox: a lock-free, single producer, single consumer queue of server
+ * messages, owned by the front-end.
+ *
+ * The server message thread is the only producer, and the main loop the only
+ * consumer; each index is only written by its own side, and published with
+ * release stores, so neither side ever takes a lock or waits for the other.
+ * The slots are a fixed ring, hence pushing fails when the inbox is full,
+ * leaving it to the producer to retry.
+ ******************************************************************************/
+
+#ifndef MSG_INBOX_H
+#define MSG_INBOX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "client_server.h"
+
+/*
+  Number of slots, a power of two.
+ */
+#define MI_CAPACITY 1024
+
+/*
+  Size of a cache line, so that the two indices are not on the same line, and
+  pushing does not slow down popping.
+ */
+#define MI_CACHE_LINE 64
+
+typedef struct {
+  msg slots[MI_CAPACITY];
+  size_t head __attribute__((aligned(MI_CACHE_LINE)));  // next slot to pop
+  size_t tail __attribute__((aligned(MI_CACHE_LINE)));  // next slot to push
+} msg_inbox;
+
+void mi_init(msg_inbox *inbox);
+bool mi_push(msg_inbox *inbox, msg m);
+bool mi_pop(msg_inbox *inbox, msg *m);
+size_t mi_depth(msg_inbox *inbox);
+
+#endif // MSG_INBOX_H
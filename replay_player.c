@@ -0,0 +1,75 @@
+/***************************************************************************//**
+ * Headless replay player: re-runs recorded games (see tetris_replay.h) through
+ * the engine and prints their outcome, either as fast as possible or at real
+ * time.
+ *
+ * Usage: ./tetris_replay [-r ticks_per_sec] replay_file...
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tetris_replay.h"
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[]){
+    int opt, i, ret = 0;
+    long long tick_nsec = 0; // as fast as possible, unless a rate is given
+
+    while((opt = getopt(argc, argv, "r:")) != -1){
+        switch(opt){
+            case 'r':
+                if(atoi(optarg) > 0){
+                    tick_nsec = 1000000000LL / atoi(optarg);
+                    break;
+                }
+                // otherwise, on a rate which is not positive, on to the usage message
+                /* fall through */
+            default:
+                fprintf(stderr, "Usage: %s [-r ticks_per_sec] replay_file...\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind >= argc){
+        fprintf(stderr, "Usage: %s [-r ticks_per_sec] replay_file...\n", argv[0]);
+        return 1;
+    }
+
+    for(i = optind; i < argc; i++){
+        tetris_replay_info info;
+        double start;
+        tetris_game *obj;
+        FILE *f = fopen(argv[i], "rb");
+
+        if(f == NULL){
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+
+        start = now_sec();
+        obj = tr_play(f, tick_nsec, &info);
+        fclose(f);
+
+        if(obj == NULL){
+            fprintf(stderr, "%s: not a replay, or of an unsupported version\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+
+        printf("%s: %dx%d seed %d, %ld ticks in %.3fs: %d points, level %d, %ld lines cleared%s%s\n", argv[i],
+               info.rows, info.cols, info.seed, info.ticks, now_sec() - start, obj->points, obj->level,
+               info.lines_cleared, tg_game_over(obj) ? ", game over" : "", info.complete ? "" : " (truncated)");
+        tg_delete(obj);
+    }
+
+    return ret;
+}
@@ -4,8 +4,8 @@
  * Modified functions are annotated accordingly. The following have been removed
  * since the feature set is beyond the scope of this assignment:
  * (i)   void tg_print(tetris_game *obj, FILE *f);
- * (ii)  void tg_save(tetris_game *obj, FILE *f);
- * (iii) tetris_game *tg_load(FILE *f);
+ * tg_save and tg_load, also originally removed, have since been reinstated as a
+ * binary snapshot of the game in memory, rather than a text file.
  *
  * The original copyright is stated below, see StephenBrennan_Tetris_LICENSE.txt
  * for further details:
@@ -17,6 +17,8 @@
 #define TETRIS_H
 
 #include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint64_t
 
 /*
   Convert a tetromino type to its corresponding cell.
@@ -54,11 +56,39 @@
 #define MAX_LEVEL 19
 #define LINES_PER_LEVEL 10
 
+/*
+  @xandru: A row of the board as an occupancy bitmask; bit j is set iff column j
+  holds a filled cell.  One machine word per row, hence a board may be at most
+  TG_MAX_COLS columns wide.  New blocks enter in the 4 middle columns, hence it
+  must be at least TG_MIN_COLS wide.
+ */
+typedef uint64_t tetris_row;
+#define TG_MAX_COLS 64
+#define TG_MIN_COLS 4
+
+/*
+  @xandru: Version of the snapshots written by tg_save; bumped whenever their
+  layout changes, and tg_load only accepts its own version.
+ */
+#define TG_SNAPSHOT_VERSION 5
+
+/*
+  @xandru: Most rows a single tick may clear: it can lock two blocks, one moved
+  down by gravity and the next one dropped.
+ */
+#define TG_MAX_CLEARED (2 * TETRIS)
+
+/*
+  @xandru: Most moves applied by tg_tick_moves in a single tick.
+ */
+#define TG_MAX_MOVES 16
+
 /*
   A "cell" is a 1x1 block within a tetris board.
  */
 typedef enum {
-  TC_EMPTY, TC_CELLI, TC_CELLJ, TC_CELLL, TC_CELLO, TC_CELLS, TC_CELLT, TC_CELLZ
+  TC_EMPTY, TC_CELLI, TC_CELLJ, TC_CELLL, TC_CELLO, TC_CELLS, TC_CELLT, TC_CELLZ,
+  TC_GARBAGE // @xandru: cells of garbage lines
 } tetris_cell;
 
 /*
@@ -87,6 +117,23 @@ typedef struct {
   tetris_location loc;
 } tetris_block;
 
+/*
+  @xandru: Garbage lines queued for a game: how many, and where their hole is,
+  either a column or one of the patterns below.
+ */
+typedef struct {
+  int lines;
+  int hole;
+} tetris_garbage;
+
+#define TG_GARBAGE_EMPTY (-1)  // empty lines
+#define TG_GARBAGE_RANDOM (-2) // a hole at a random column, for every line
+
+/*
+  @xandru: How many garbage entries with distinct holes may be queued.
+ */
+#define TG_GARBAGE_QUEUE 8
+
 /*
   All possible moves to give as input to the game.
  */
@@ -103,7 +150,24 @@ typedef struct{
    */
   int rows;
   int cols;
+  /*
+    @xandru: board holds locked cells only; the falling block is kept apart,
+    and laid over the board by tg_get.
+   */
   char *board;
+  /*
+    @xandru: Occupancy bitmask per row, kept in sync with board by every change
+    to the board, and the value of a completely filled row.  board still stores
+    the cell types, for the renderer.  Both live in a single allocation owned by
+    rowbits.
+   */
+  tetris_row *rowbits;
+  tetris_row full_row;
+  /*
+    @xandru: Per row flag, set whenever a cell in the row may have changed since
+    the last tg_clear_dirty, so that renderers only redraw those rows.
+   */
+  char *dirty;
   /*
     Scoring information:
    */
@@ -124,6 +188,41 @@ typedef struct{
     Number of lines until you advance to the next level.
    */
   int lines_remaining;
+  /*
+    @xandru: State of the LCG picking the next tetromino, seeded by tg_init.
+    Kept per game so that games are independent and reproducible from their
+    seed, with no global state in the engine.
+   */
+  long rand_state;
+  /*
+    @xandru: Rows touched by blocks locked since the last line check, the only
+    ones which may have become full; none if lock_top > lock_bottom.
+   */
+  int lock_top;
+  int lock_bottom;
+  /*
+    @xandru: Rows cleared by the last tick, from the bottom up and numbered as
+    before they were cleared, for renderers and the network layer.
+   */
+  int cleared_rows[TG_MAX_CLEARED];
+  int n_cleared;
+  /*
+    @xandru: Garbage queued by tg_queue_garbage, for the end of the next tick,
+    and the state of the LCG picking random holes.
+   */
+  tetris_garbage garbage[TG_GARBAGE_QUEUE];
+  int n_garbage;
+  long garbage_state;
+  /*
+    @xandru: Height map: the topmost filled row of each column, or rows if the
+    column is empty, not counting the falling block.
+   */
+  int heights[TG_MAX_COLS];
+  /*
+    @xandru: Whether the game is over, kept up to date as the board changes and
+    accessed atomically, see tg_game_over.
+   */
+  int over;
 } tetris_game;
 
 /*
@@ -133,16 +232,50 @@ typedef struct{
   array contains 4 tetris_location objects, each mapping to an offset from a
   point on the upper left that is the tetromino "origin".
  */
-extern tetris_location TETROMINOS[NUM_TETROMINOS][NUM_ORIENTATIONS][TETRIS];
+extern const tetris_location TETROMINOS[NUM_TETROMINOS][NUM_ORIENTATIONS][TETRIS];
+
+/*
+  @xandru: The same cells as row bitmasks, for collision tests on the board's
+  row bitmasks.  rows[i] holds the cells of row top+i of the block, with bit 0
+  at column left; top, bottom, left and right are the extents of the block, as
+  offsets from its location like the TETROMINOS offsets.
+ */
+typedef struct {
+  unsigned char rows[TETRIS];
+  signed char top;
+  signed char bottom;
+  signed char left;
+  signed char right;
+} tetris_shape;
+
+extern const tetris_shape TETROMINO_SHAPES[NUM_TETROMINOS][NUM_ORIENTATIONS];
 
 /*
   This array tells you how many ticks per gravity by level.  Decreases as level
   increases, to add difficulty.
  */
-extern int GRAVITY_LEVEL[MAX_LEVEL+1];
+extern const int GRAVITY_LEVEL[MAX_LEVEL+1];
+
+/*
+  @xandru: Board primitives on bare row bitmask and cell arrays, shared by the
+  single game engine and the batch engine (tetris_batch.h).
+ */
+bool tb_fits(const tetris_row *rowbits, int rows, int cols, tetris_block block);
+void tb_put(tetris_row *rowbits, char *cells, int cols, tetris_block block);
+void tb_block_rows(tetris_block block, int *top, int *bottom);
+int tb_clear_lines(tetris_row *rowbits, char *cells, int cols,
+                   tetris_row full_row, int top, int bottom, int *cleared);
+void tb_seed_random(long *rand_state, int seed);
+long tb_random(long *rand_state);
+int tb_random_tetromino(long *rand_state);
+void tb_adjust_score(int *points, int *level, int *lines_remaining,
+                     int lines_cleared);
 
 // Data structure manipulation.
-void tg_init(tetris_game *obj, int rows, int cols, int seed); //@xandru: added seed
+// @xandru: added seed; tg_init fails, and tg_create returns NULL, unless there
+// are at least 2 rows and TG_MIN_COLS to TG_MAX_COLS columns, or if out of
+// memory
+bool tg_init(tetris_game *obj, int rows, int cols, int seed);
 tetris_game *tg_create(int rows, int cols, int seed); //@xandru: added seed
 void tg_destroy(tetris_game *obj);
 void tg_delete(tetris_game *obj);
@@ -151,8 +284,20 @@ void tg_delete(tetris_game *obj);
 char tg_get(tetris_game *obj, int row, int col);
 bool tg_check(tetris_game *obj, int row, int col);
 int tg_tick(tetris_game *obj, tetris_move move);
+int tg_tick_moves(tetris_game *obj, const tetris_move *moves, int n); // @xandru: newly added
 void tg_add_lines(tetris_game *obj, int n); // @xandru: newly added
+void tg_queue_garbage(tetris_game *obj, int n, int hole); // @xandru: newly added
 bool tg_game_over(tetris_game *obj); // @xandru: made public
-void set_lcg(int seed); // @xandru: set lcg seed to passed seed
+int tg_drop_distance(tetris_game *obj); // @xandru: newly added
+tetris_block tg_ghost(tetris_game *obj); // @xandru: newly added
+bool tg_row_dirty(tetris_game *obj, int row); // @xandru: newly added
+void tg_clear_dirty(tetris_game *obj); // @xandru: newly added
+
+// @xandru: Binary snapshots, e.g. to resync after a reconnect or to checkpoint
+// a session.  A snapshot is one contiguous buffer of tg_snapshot_size bytes, in
+// the byte order of the machine which wrote it.
+size_t tg_snapshot_size(tetris_game *obj);
+size_t tg_save(tetris_game *obj, void *buf, size_t len);
+bool tg_load(tetris_game *obj, const void *buf, size_t len);
 
 #endif // TETRIS_H
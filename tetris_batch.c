@@ -0,0 +1,491 @@
+/***************************************************************************//**
+ * Batch engine: steps many tetris games of the same board size in lockstep,
+ * see tetris_batch.h.
+ *
+ * Each tick is split into contiguous slices of games, one per thread.  Within a
+ * slice the tick runs in phases, each a loop over the per-game arrays: gravity
+ * counters, gravity moves, input moves, and finally line checks, scoring and
+ * game over checks for only those games which locked a block this tick.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "tetris_batch.h"
+
+/*
+  The worker threads of a batch.  Thread 0 is the caller of tg_batch_tick;
+  threads 1 to nthreads-1 wait for a new generation to be published, step their
+  slice and report back.
+ */
+typedef struct {
+  tetris_batch_pool *pool;
+  int slice;
+} tetris_batch_worker;
+
+struct tetris_batch_pool {
+  int nthreads;
+  pthread_t *threads;
+  tetris_batch_worker *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned long generation;
+  int pending;
+  bool quit;
+  /*
+    The tick being run.
+   */
+  tetris_batch *batch;
+  const tetris_move *moves;
+  int *lines_cleared;
+  /*
+    Per slice count of running games, and per game scratch space: indices of
+    games due a gravity move, whether a game locked a block this tick, and the
+    rows touched by the blocks it locked.
+   */
+  int *running;
+  int *due;
+  bool *locked;
+  int *lock_top;
+  int *lock_bottom;
+};
+
+/*******************************************************************************
+
+                               Per-Game Helpers
+
+*******************************************************************************/
+
+static tetris_row *tg_batch_rowbits(tetris_batch *batch, int i)
+{
+  return batch->rowbits + (size_t) i * batch->rows;
+}
+
+static char *tg_batch_cells(tetris_batch *batch, int i)
+{
+  return batch->cells + (size_t) i * batch->rows * batch->cols;
+}
+
+static bool tg_batch_fits(tetris_batch *batch, int i, tetris_block block)
+{
+  return tb_fits(tg_batch_rowbits(batch, i), batch->rows, batch->cols, block);
+}
+
+/*
+  Create a new falling block for game i, as tg_new_falling does.
+ */
+static void tg_batch_new_falling(tetris_batch *batch, int i)
+{
+  batch->falling[i] = batch->next[i];
+  batch->next[i].typ = tb_random_tetromino(&batch->rand_state[i]);
+  batch->next[i].ori = 0;
+  batch->next[i].loc.row = 0;
+  batch->next[i].loc.col = batch->cols/2 - 2;
+}
+
+/*
+  Lock the falling block of game i into its board, and bring in the next one.
+ */
+static void tg_batch_lock(tetris_batch_pool *pool, int i)
+{
+  tetris_batch *batch = pool->batch;
+  tb_put(tg_batch_rowbits(batch, i), tg_batch_cells(batch, i), batch->cols,
+         batch->falling[i]);
+  if (!pool->locked[i]) {
+    pool->lock_top[i] = batch->rows;
+    pool->lock_bottom[i] = -1;
+  }
+  tb_block_rows(batch->falling[i], &pool->lock_top[i], &pool->lock_bottom[i]);
+  tg_batch_new_falling(batch, i);
+  pool->locked[i] = true;
+}
+
+/*
+  Perform a move for game i, following tg_handle_move.
+ */
+static void tg_batch_move(tetris_batch_pool *pool, int i, tetris_move move)
+{
+  tetris_batch *batch = pool->batch;
+  tetris_block *falling = &batch->falling[i];
+  int k, direction;
+
+  switch (move) {
+  case TM_LEFT:
+  case TM_RIGHT:
+    direction = move == TM_LEFT ? -1 : 1;
+    falling->loc.col += direction;
+    if (!tg_batch_fits(batch, i, *falling)) {
+      falling->loc.col -= direction;
+    }
+    break;
+  case TM_DROP:
+    // as tg_down: a block which does not fit where it is stays there
+    if (tg_batch_fits(batch, i, *falling)) {
+      while (tg_batch_fits(batch, i, *falling)) {
+        falling->loc.row++;
+      }
+      falling->loc.row--;
+    }
+    tg_batch_lock(pool, i);
+    break;
+  case TM_CLOCK:
+  case TM_COUNTER:
+    direction = move == TM_CLOCK ? 1 : -1;
+    // bounded as in tg_rotate, in case the block does not fit even as it is
+    for (k = 0; k < NUM_ORIENTATIONS; k++) {
+      falling->ori = (falling->ori + direction + NUM_ORIENTATIONS) %
+                     NUM_ORIENTATIONS;
+      if (tg_batch_fits(batch, i, *falling))
+        break;
+      falling->loc.col--;
+      if (tg_batch_fits(batch, i, *falling))
+        break;
+      falling->loc.col += 2;
+      if (tg_batch_fits(batch, i, *falling))
+        break;
+      falling->loc.col--;
+    }
+    break;
+  case TM_HOLD:
+    if (batch->stored[i].typ == -1) {
+      batch->stored[i] = *falling;
+      tg_batch_new_falling(batch, i);
+    } else {
+      tetris_block held = *falling, stored = batch->stored[i];
+      int top = batch->rows, bottom = -1;
+      falling->typ = stored.typ;
+      falling->ori = stored.ori;
+      batch->stored[i].typ = held.typ;
+      batch->stored[i].ori = held.ori;
+      // as tg_hold: moved up at most to the top of the board, and refused if
+      // it does not fit even there
+      tb_block_rows(*falling, &top, &bottom);
+      while (top > 0 && !tg_batch_fits(batch, i, *falling)) {
+        falling->loc.row--;
+        top--;
+      }
+      if (!tg_batch_fits(batch, i, *falling)) {
+        *falling = held;
+        batch->stored[i] = stored;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/*******************************************************************************
+
+                                 Batch Tick
+
+*******************************************************************************/
+
+/*
+  Step games lo to hi-1 by one tick, returning how many of them are running.
+ */
+static int tg_batch_step(tetris_batch_pool *pool, int lo, int hi)
+{
+  tetris_batch *batch = pool->batch;
+  const tetris_move *moves = pool->moves;
+  int *due = pool->due + lo;
+  int i, k, ndue = 0, running = 0;
+
+  memset(pool->locked + lo, 0, (hi - lo) * sizeof(bool));
+  if (pool->lines_cleared) {
+    memset(pool->lines_cleared + lo, 0, (hi - lo) * sizeof(int));
+  }
+
+  // Gravity counters.
+  for (i = lo; i < hi; i++) {
+    if (!batch->over[i] && --batch->ticks_till_gravity[i] <= 0) {
+      due[ndue++] = i;
+    }
+  }
+
+  // Gravity moves, for only the games which are due one.
+  for (k = 0; k < ndue; k++) {
+    i = due[k];
+    batch->falling[i].loc.row++;
+    if (tg_batch_fits(batch, i, batch->falling[i])) {
+      batch->ticks_till_gravity[i] = GRAVITY_LEVEL[batch->level[i]];
+    } else {
+      batch->falling[i].loc.row--;
+      tg_batch_lock(pool, i);
+    }
+  }
+
+  // Input.
+  if (moves) {
+    for (i = lo; i < hi; i++) {
+      if (moves[i] != TM_NONE && !batch->over[i]) {
+        tg_batch_move(pool, i, moves[i]);
+      }
+    }
+  }
+
+  // Lines, score and game over can only change for games which locked a block.
+  for (i = lo; i < hi; i++) {
+    if (pool->locked[i]) {
+      tetris_row *rowbits = tg_batch_rowbits(batch, i);
+      int lines = tb_clear_lines(rowbits, tg_batch_cells(batch, i), batch->cols,
+                                 batch->full_row, pool->lock_top[i],
+                                 pool->lock_bottom[i], NULL);
+      if (lines) {
+        tb_adjust_score(&batch->points[i], &batch->level[i],
+                        &batch->lines_remaining[i], lines);
+        if (pool->lines_cleared) {
+          pool->lines_cleared[i] = lines;
+        }
+      }
+      batch->over[i] = batch->over[i] || (rowbits[0] | rowbits[1]) != 0;
+    }
+    running += !batch->over[i];
+  }
+
+  return running;
+}
+
+static void tg_batch_step_slice(tetris_batch_pool *pool, int slice)
+{
+  int n = pool->batch->n;
+  int lo = (int) ((long) n * slice / pool->nthreads);
+  int hi = (int) ((long) n * (slice + 1) / pool->nthreads);
+  pool->running[slice] = tg_batch_step(pool, lo, hi);
+}
+
+static void *tg_batch_worker_main(void *arg)
+{
+  tetris_batch_worker *worker = arg;
+  tetris_batch_pool *pool = worker->pool;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->quit && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->quit) {
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    tg_batch_step_slice(pool, worker->slice);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+int tg_batch_tick(tetris_batch *batch, const tetris_move *moves,
+                  int *lines_cleared)
+{
+  tetris_batch_pool *pool = batch->pool;
+  int t, running = 0;
+
+  pool->batch = batch;
+  pool->moves = moves;
+  pool->lines_cleared = lines_cleared;
+
+  if (pool->nthreads > 1) {
+    pthread_mutex_lock(&pool->lock);
+    pool->pending = pool->nthreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  tg_batch_step_slice(pool, 0);
+
+  if (pool->nthreads > 1) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+      pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  for (t = 0; t < pool->nthreads; t++) {
+    running += pool->running[t];
+  }
+  return running;
+}
+
+/*******************************************************************************
+
+                             Creation and Queries
+
+*******************************************************************************/
+
+void tg_batch_reset(tetris_batch *batch, int i, int seed)
+{
+  memset(tg_batch_rowbits(batch, i), 0, batch->rows * sizeof(tetris_row));
+  memset(tg_batch_cells(batch, i), TC_EMPTY, batch->rows * batch->cols);
+  batch->points[i] = 0;
+  batch->level[i] = 0;
+  batch->ticks_till_gravity[i] = GRAVITY_LEVEL[0];
+  batch->lines_remaining[i] = LINES_PER_LEVEL;
+  tb_seed_random(&batch->rand_state[i], seed);
+  batch->over[i] = false;
+  tg_batch_new_falling(batch, i);
+  tg_batch_new_falling(batch, i);
+  batch->stored[i].typ = -1;
+  batch->stored[i].ori = 0;
+  batch->stored[i].loc.row = 0;
+  batch->stored[i].loc.col = 0;
+}
+
+static void tg_batch_pool_delete(tetris_batch_pool *pool, int started)
+{
+  int t;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (t = 0; t < started; t++) {
+    pthread_join(pool->threads[t], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->threads);
+  free(pool->workers);
+  free(pool->running);
+  free(pool->due);
+  free(pool->locked);
+  free(pool->lock_top);
+  free(pool->lock_bottom);
+  free(pool);
+}
+
+static tetris_batch_pool *tg_batch_pool_create(int n, int nthreads)
+{
+  int t;
+  tetris_batch_pool *pool = calloc(1, sizeof(tetris_batch_pool));
+
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->nthreads = nthreads;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->threads = calloc(nthreads, sizeof(pthread_t));
+  pool->workers = calloc(nthreads, sizeof(tetris_batch_worker));
+  pool->running = calloc(nthreads, sizeof(int));
+  pool->due = calloc(n, sizeof(int));
+  pool->locked = calloc(n, sizeof(bool));
+  pool->lock_top = calloc(n, sizeof(int));
+  pool->lock_bottom = calloc(n, sizeof(int));
+  if (!pool->threads || !pool->workers || !pool->running || !pool->due ||
+      !pool->locked || !pool->lock_top || !pool->lock_bottom) {
+    tg_batch_pool_delete(pool, 0);
+    return NULL;
+  }
+
+  for (t = 1; t < nthreads; t++) {
+    pool->workers[t].pool = pool;
+    pool->workers[t].slice = t;
+    if (pthread_create(&pool->threads[t-1], NULL, tg_batch_worker_main,
+                       &pool->workers[t]) != 0) {
+      tg_batch_pool_delete(pool, t-1);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+tetris_batch *tg_batch_create(int n, int rows, int cols, const int *seeds,
+                              int nthreads)
+{
+  int i;
+  tetris_batch *batch = calloc(1, sizeof(tetris_batch));
+
+  if (batch == NULL || n <= 0 || rows < 2 || cols < TG_MIN_COLS ||
+      cols > TG_MAX_COLS) {
+    free(batch);
+    return NULL;
+  }
+
+  if (nthreads <= 0) {
+    nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  nthreads = nthreads < 1 ? 1 : (nthreads > n ? n : nthreads);
+
+  batch->n = n;
+  batch->rows = rows;
+  batch->cols = cols;
+  batch->full_row = cols == TG_MAX_COLS ? ~(tetris_row) 0
+                                        : ((tetris_row) 1 << cols) - 1;
+  batch->rowbits = malloc((size_t) n * rows * sizeof(tetris_row));
+  batch->cells = malloc((size_t) n * rows * cols);
+  batch->falling = malloc(n * sizeof(tetris_block));
+  batch->next = malloc(n * sizeof(tetris_block));
+  batch->stored = malloc(n * sizeof(tetris_block));
+  batch->points = malloc(n * sizeof(int));
+  batch->level = malloc(n * sizeof(int));
+  batch->lines_remaining = malloc(n * sizeof(int));
+  batch->ticks_till_gravity = malloc(n * sizeof(int));
+  batch->rand_state = malloc(n * sizeof(long));
+  batch->over = malloc(n * sizeof(bool));
+
+  if (!batch->rowbits || !batch->cells || !batch->falling || !batch->next ||
+      !batch->stored || !batch->points || !batch->level ||
+      !batch->lines_remaining || !batch->ticks_till_gravity ||
+      !batch->rand_state || !batch->over ||
+      !(batch->pool = tg_batch_pool_create(n, nthreads))) {
+    tg_batch_delete(batch);
+    return NULL;
+  }
+
+  for (i = 0; i < n; i++) {
+    tg_batch_reset(batch, i, seeds ? seeds[i] : i);
+  }
+
+  return batch;
+}
+
+void tg_batch_delete(tetris_batch *batch)
+{
+  if (batch->pool) {
+    tg_batch_pool_delete(batch->pool, batch->pool->nthreads - 1);
+  }
+  free(batch->rowbits);
+  free(batch->cells);
+  free(batch->falling);
+  free(batch->next);
+  free(batch->stored);
+  free(batch->points);
+  free(batch->level);
+  free(batch->lines_remaining);
+  free(batch->ticks_till_gravity);
+  free(batch->rand_state);
+  free(batch->over);
+  free(batch);
+}
+
+char tg_batch_get(tetris_batch *batch, int i, int row, int col)
+{
+  int b;
+  tetris_block falling = batch->falling[i];
+
+  for (b = 0; b < TETRIS; b++) {
+    tetris_location cell = TETROMINOS[falling.typ][falling.ori][b];
+    if (falling.loc.row + cell.row == row && falling.loc.col + cell.col == col) {
+      return TYPE_TO_CELL(falling.typ);
+    }
+  }
+  return tg_batch_cells(batch, i)[batch->cols * row + col];
+}
@@ -0,0 +1,97 @@
+/***************************************************************************//**
+ * Batch engine: steps many tetris games of the same board size in lockstep.
+ *
+ * Intended for simulation workloads (AI training, server-side score checks),
+ * where the state of all games is kept in contiguous struct-of-arrays storage
+ * and each tick is a handful of tight loops over those arrays, split across a
+ * pool of worker threads.  The rules are those of tetris.h, through the shared
+ * board primitives, so a game in a batch plays out exactly as the equivalent
+ * tetris_game given the same seed and moves.
+ *
+ * Unlike tetris_game, the falling block is never written into the board; the
+ * board arrays only hold locked cells.
+ ******************************************************************************/
+
+#ifndef TETRIS_BATCH_H
+#define TETRIS_BATCH_H
+
+#include <stdbool.h>
+
+#include "tetris.h"
+
+typedef struct tetris_batch_pool tetris_batch_pool;
+
+/*
+  A batch of games, stored as struct-of-arrays: index i of every per-game array
+  belongs to game i.
+ */
+typedef struct {
+  /*
+    Number of games, and the board size shared by all of them.
+   */
+  int n;
+  int rows;
+  int cols;
+  tetris_row full_row;
+  /*
+    Locked cells: game i owns rowbits[i*rows .. (i+1)*rows) and
+    cells[i*rows*cols .. (i+1)*rows*cols).
+   */
+  tetris_row *rowbits;
+  char *cells;
+  /*
+    Blocks, as in tetris_game.
+   */
+  tetris_block *falling;
+  tetris_block *next;
+  tetris_block *stored;
+  /*
+    Scoring, gravity and generator state, as in tetris_game.
+   */
+  int *points;
+  int *level;
+  int *lines_remaining;
+  int *ticks_till_gravity;
+  long *rand_state;
+  /*
+    Whether game i is over.  Games which are over are no longer stepped, until
+    reset with tg_batch_reset.
+   */
+  bool *over;
+  /*
+    Worker threads splitting each tick between them.
+   */
+  tetris_batch_pool *pool;
+} tetris_batch;
+
+/*
+  Create n games of rows x cols, game i seeded with seeds[i] (or i if seeds is
+  NULL), stepped by nthreads threads (including the caller) per tick.  As for
+  tg_init, rows must be at least 2 and cols between TG_MIN_COLS and TG_MAX_COLS.
+  Returns NULL on failure.
+ */
+tetris_batch *tg_batch_create(int n, int rows, int cols, const int *seeds,
+                              int nthreads);
+void tg_batch_delete(tetris_batch *batch);
+
+/*
+  Restart game i from the given seed.
+ */
+void tg_batch_reset(tetris_batch *batch, int i, int seed);
+
+/*
+  Do a single game tick for every game that is not over, game i taking the move
+  moves[i] (all TM_NONE if moves is NULL).  If lines_cleared is not NULL, the
+  number of lines game i cleared is stored in lines_cleared[i].  Returns the
+  number of games still running.
+ */
+int tg_batch_tick(tetris_batch *batch, const tetris_move *moves,
+                  int *lines_cleared);
+
+/*
+  Return the cell at the given row and column of game i, including its falling
+  block, as tg_get does.
+ */
+char tg_batch_get(tetris_batch *batch, int i, int row, int col);
+
+#endif // TETRIS_BATCH_H
@@ -0,0 +1,448 @@
+/***************************************************************************//**
+ * Headless throughput benchmark for the tetris engine.
+ *
+ * Drives seeded, scripted move streams through tg_create, tg_tick and
+ * tg_queue_garbage on several board sizes, reporting ticks/sec and
+ * line-clears/sec, followed by the cost in ns of the engine primitives tg_fits,
+ * tg_check_lines, tg_down, tg_rotate, tg_save and tg_load.  Scripts are
+ * recorded up front by a simple greedy player, then played back in the timed
+ * runs.  Finally, the batch engine (tetris_batch.h) and the placement search
+ * (tetris_search.h) are timed on one thread and on all of them.
+ *
+ * The primitives are static to tetris.c, hence the engine source is compiled
+ * directly into this translation unit rather than linked; neither ncurses nor
+ * the client library are involved.
+ *
+ * Usage: ./tetris_bench [seed] [ticks_per_board]
+ ******************************************************************************/
+
+#include "tetris.c"
+#include "tetris_batch.h"
+#include "tetris_search.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SEED 2008
+#define DEFAULT_TICKS 1000000
+#define PRIMITIVE_ITERS 1000000
+#define PRIMITIVE_POOL 64
+#define PREPARE_TICKS 5000
+#define BATCH_GAMES 4096
+#define BATCH_TICKS 2000
+#define BATCH_MOVE_TICKS 64
+
+// Blocks placed by the search per depth, from 1 up, as each ply multiplies the placements scored by ~30 to ~200
+static const int SEARCH_BLOCKS[] = {2000, 200, 8};
+#define SEARCH_DEPTHS (sizeof(SEARCH_BLOCKS) / sizeof(SEARCH_BLOCKS[0]))
+
+// Board sizes to benchmark, as {rows, cols}
+static const int BOARD_SIZES[][2] = {{22, 10}, {40, 16}, {64, 32}, {128, 64}};
+#define NUM_BOARD_SIZES (sizeof(BOARD_SIZES) / sizeof(BOARD_SIZES[0]))
+
+// Sink for results which would otherwise be optimised away
+static volatile long bench_sink;
+
+// Simple LCG for the scripted move streams, independent of the engine's own
+static unsigned int script_state;
+
+static unsigned int script_rand(void){
+    script_state = script_state * 1103515245u + 12345u;
+    return script_state >> 16;
+}
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Snapshot (see tg_save) of the mid-game state on which the primitives are timed, restored with tg_load into a pool of
+ * games between the timed passes of a mutating one
+ */
+static unsigned char *snapshot;
+static size_t snapshot_len;
+
+static void take_snapshot(tetris_game *obj){
+    free(snapshot);
+    snapshot_len = tg_snapshot_size(obj);
+    snapshot = malloc(snapshot_len);
+    tg_save(obj, snapshot, snapshot_len);
+}
+
+/* Script entries are either a tetris_move, or one of the following events which the script applies after the tick's
+ * move, as main.c does.
+ */
+#define SCRIPT_ADD_LINE  (TM_NONE + 1) // tg_queue_garbage(obj, 1, TG_GARBAGE_RANDOM)
+#define SCRIPT_ADD_LINES (TM_NONE + 2) // tg_queue_garbage(obj, 2, TG_GARBAGE_RANDOM)
+#define SCRIPT_RESTART   (TM_NONE + 3) // game over: start a new game
+
+/* Returns true if locked cells reach into the top four rows; the benchmark restarts games there, so as to time
+ * mid-game play rather than the crowded end of games.
+ */
+static bool stack_too_high(tetris_game *obj){
+    return (obj->rowbits[0] | obj->rowbits[1] | obj->rowbits[2] | obj->rowbits[3]) != 0;
+}
+
+/* Greedy placement for the falling block: the orientation and column which let it land lowest. Lines are cleared
+ * regularly on every board size, without the planning cost showing up in the timed runs.
+ */
+static tetris_block plan_target(tetris_game *obj){
+    int ori, col, i, depth, best_depth = -1;
+    tetris_block try, best = obj->falling;
+
+    for(ori = 0; ori < NUM_ORIENTATIONS; ori++){
+        for(col = -2; col < obj->cols; col++){
+            try = obj->falling;
+            try.ori = ori;
+            try.loc.col = col;
+            if(!tg_fits(obj, try)){
+                continue;
+            }
+
+            while(tg_fits(obj, try)){
+                try.loc.row++;
+            }
+            try.loc.row--;
+
+            for(depth = 0, i = 0; i < TETRIS; i++){
+                depth += try.loc.row + TETROMINOS[try.typ][ori][i].row;
+            }
+            if(depth > best_depth){
+                best_depth = depth;
+                best = try;
+            }
+        }
+    }
+
+    return best;
+}
+
+/* Record a script of n ticks by playing it: each block is rotated and shifted towards its planned target one move per
+ * tick, with idle ticks mixed in, as in real play, and then dropped.
+ */
+static signed char *record_script(int rows, int cols, int seed, long n){
+    long t;
+    tetris_block target = {0};
+    int restarts = 0, planned_for = -1;
+    signed char *script = malloc(3 * n); // at most a move, garbage and a restart per tick
+    long len = 0;
+    tetris_game *obj = tg_create(rows, cols, seed);
+
+    script_state = seed;
+    for(t = 0; t < n; t++){
+        tetris_move move = TM_NONE;
+
+        if(planned_for != obj->falling.typ * 1000 + obj->falling.loc.row){
+            // new block, or a known one has moved down: re-plan
+            target = plan_target(obj);
+            planned_for = obj->falling.typ * 1000 + obj->falling.loc.row;
+        }
+
+        if(script_rand() % 100 >= 60){
+            if(obj->falling.ori != target.ori){
+                move = TM_CLOCK;
+            }else if(obj->falling.loc.col > target.loc.col){
+                move = TM_LEFT;
+            }else if(obj->falling.loc.col < target.loc.col){
+                move = TM_RIGHT;
+            }else{
+                move = TM_DROP;
+            }
+        }
+
+        tg_tick(obj, move);
+        script[len++] = move;
+
+        // occasional garbage, as in a RISING_TIDE session
+        if(script_rand() % 1024 == 0){
+            int lines = 1 + script_rand() % 2;
+            tg_queue_garbage(obj, lines, TG_GARBAGE_RANDOM);
+            script[len++] = lines == 1 ? SCRIPT_ADD_LINE : SCRIPT_ADD_LINES;
+        }
+
+        if(tg_game_over(obj) || stack_too_high(obj)){
+            tg_delete(obj);
+            obj = tg_create(rows, cols, seed + ++restarts);
+            script[len++] = SCRIPT_RESTART;
+        }
+    }
+
+    tg_delete(obj);
+    return script;
+}
+
+/* Play back the first n ticks of a recorded script, returning the game in its final state. The game over check is
+ * made every tick, as in main.c.
+ */
+static tetris_game *play_script(int rows, int cols, int seed, signed char *script, long n, long *lines){
+    long t = 0;
+    int restarts = 0;
+    tetris_game *obj = tg_create(rows, cols, seed);
+
+    for(; t < n; script++){
+        switch(*script){
+            case SCRIPT_ADD_LINE:
+                tg_queue_garbage(obj, 1, TG_GARBAGE_RANDOM);
+                break;
+            case SCRIPT_ADD_LINES:
+                tg_queue_garbage(obj, 2, TG_GARBAGE_RANDOM);
+                break;
+            case SCRIPT_RESTART:
+                tg_delete(obj);
+                obj = tg_create(rows, cols, seed + ++restarts);
+                break;
+            default:
+                *lines += tg_tick(obj, (tetris_move) *script);
+                bench_sink += tg_game_over(obj);
+                t++;
+        }
+    }
+
+    return obj;
+}
+
+static void bench_throughput(int rows, int cols, int seed, long ticks){
+    long lines = 0;
+    double start, elapsed;
+    signed char *script = record_script(rows, cols, seed, ticks);
+
+    start = now_sec();
+    tg_delete(play_script(rows, cols, seed, script, ticks, &lines));
+    elapsed = now_sec() - start;
+
+    printf("%4dx%-3d %14.0f %16.0f %10ld\n", rows, cols, ticks / elapsed, lines / elapsed, lines);
+    free(script);
+}
+
+/* Primitive timings. Each operation is applied to a mid-game board state. The mutating ones are applied once to each
+ * game of a pool holding that state, and only those passes are timed; the pool is restored in between, untimed.
+ */
+typedef enum{
+    OP_RESTORE, OP_SAVE, OP_FITS, OP_CHECK_LINES, OP_CHECK_LINES_CLEAR, OP_DOWN, OP_ROTATE
+} bench_op;
+
+static double bench_mutating(bench_op op, tetris_game **pool){
+    long i, calls = 0;
+    int j;
+    double start, elapsed = 0;
+
+    for(i = 0; i < PRIMITIVE_ITERS / PRIMITIVE_POOL; i++){
+        for(j = 0; j < PRIMITIVE_POOL; j++){
+            tg_load(pool[j], snapshot, snapshot_len);
+            // as if a block was just locked into the bottom rows, the only ones tg_check_lines then inspects
+            pool[j]->lock_top = pool[j]->rows - TETRIS;
+            pool[j]->lock_bottom = pool[j]->rows - 1;
+        }
+
+        start = now_sec();
+        for(j = 0; j < PRIMITIVE_POOL; j++){
+            switch(op){
+                case OP_CHECK_LINES:
+                case OP_CHECK_LINES_CLEAR:
+                    bench_sink += tg_check_lines(pool[j]);
+                    break;
+                case OP_DOWN:
+                    tg_down(pool[j]);
+                    break;
+                case OP_ROTATE:
+                    tg_rotate(pool[j], 1);
+                    break;
+                default:
+                    break;
+            }
+        }
+        elapsed += now_sec() - start;
+        calls += PRIMITIVE_POOL;
+    }
+
+    return elapsed * 1e9 / calls;
+}
+
+static double bench_primitive(bench_op op, tetris_game *work, unsigned char *scratch, tetris_block *blocks, int nblocks){
+    long i;
+    double start;
+
+    start = now_sec();
+    for(i = 0; i < PRIMITIVE_ITERS; i++){
+        switch(op){
+            case OP_FITS:
+                bench_sink += tg_fits(work, blocks[i % nblocks]);
+                break;
+            case OP_RESTORE:
+                tg_load(work, snapshot, snapshot_len);
+                break;
+            case OP_SAVE:
+                bench_sink += tg_save(work, scratch, snapshot_len);
+                break;
+            default: // mutating, see bench_mutating
+                break;
+        }
+    }
+
+    return (now_sec() - start) * 1e9 / PRIMITIVE_ITERS;
+}
+
+// Fill the bottom n rows of obj, leaving no holes, so that tg_check_lines has lines to clear
+static void fill_bottom(tetris_game *obj, int n){
+    int i;
+
+    for(i = obj->rows - n; i < obj->rows; i++){
+        obj->rowbits[i] = obj->full_row;
+        memset(obj->board + i * obj->cols, TC_CELLI, obj->cols);
+    }
+    tg_update_heights(obj, 0, obj->full_row);
+}
+
+static void bench_primitives(int rows, int cols, int seed){
+    int i;
+    long lines = 0;
+    tetris_block blocks[256];
+    tetris_game *pool[PRIMITIVE_POOL];
+    signed char *script = record_script(rows, cols, seed, PREPARE_TICKS);
+    tetris_game *base = play_script(rows, cols, seed, script, PREPARE_TICKS, &lines); // a mid-game state
+    tetris_game *work = tg_create(rows, cols, seed);
+    unsigned char *scratch;
+
+    take_snapshot(base);
+    scratch = malloc(snapshot_len);
+    tg_load(work, snapshot, snapshot_len);
+    for(i = 0; i < PRIMITIVE_POOL; i++){
+        pool[i] = tg_create(rows, cols, seed);
+    }
+
+    // random candidate placements for tg_fits, over the whole board
+    for(i = 0; i < 256; i++){
+        blocks[i].typ = script_rand() % NUM_TETROMINOS;
+        blocks[i].ori = script_rand() % NUM_ORIENTATIONS;
+        blocks[i].loc.row = (int) (script_rand() % (rows + 2)) - 2;
+        blocks[i].loc.col = (int) (script_rand() % (cols + 2)) - 2;
+    }
+
+    printf("%4dx%-3d %10.1f", rows, cols, bench_primitive(OP_FITS, work, scratch, blocks, 256));
+    printf(" %13.1f", bench_mutating(OP_CHECK_LINES, pool));
+    printf(" %10.1f", bench_mutating(OP_DOWN, pool));
+    printf(" %10.1f", bench_mutating(OP_ROTATE, pool));
+    printf(" %10.1f", bench_primitive(OP_SAVE, work, scratch, blocks, 256));
+    printf(" %10.1f", bench_primitive(OP_RESTORE, work, scratch, blocks, 256));
+
+    fill_bottom(base, TETRIS);
+    take_snapshot(base);
+    printf(" %15.1f\n", bench_mutating(OP_CHECK_LINES_CLEAR, pool));
+
+    for(i = 0; i < PRIMITIVE_POOL; i++){
+        tg_delete(pool[i]);
+    }
+    tg_delete(base);
+    tg_delete(work);
+    free(scratch);
+    free(script);
+}
+
+/* Batch engine throughput, in game-ticks/sec, stepping BATCH_GAMES games with random moves. Games which end are
+ * restarted, so that the whole batch stays busy.
+ */
+static void bench_batch(int rows, int cols, int seed, int nthreads){
+    int i, t;
+    long lines = 0;
+    double start, elapsed;
+    int *cleared = malloc(BATCH_GAMES * sizeof(int));
+    tetris_move *moves = malloc((size_t) BATCH_MOVE_TICKS * BATCH_GAMES * sizeof(tetris_move));
+    tetris_batch *batch = tg_batch_create(BATCH_GAMES, rows, cols, NULL, nthreads);
+
+    script_state = seed;
+    for(i = 0; i < BATCH_MOVE_TICKS * BATCH_GAMES; i++){
+        unsigned int r = script_rand() % 100;
+        moves[i] = r < 70 ? TM_NONE : (r < 80 ? TM_LEFT : (r < 90 ? TM_RIGHT : (r < 97 ? TM_CLOCK : TM_DROP)));
+    }
+
+    start = now_sec();
+    for(t = 0; t < BATCH_TICKS; t++){
+        tg_batch_tick(batch, moves + (size_t) (t % BATCH_MOVE_TICKS) * BATCH_GAMES, cleared);
+        for(i = 0; i < BATCH_GAMES; i++){
+            lines += cleared[i];
+            if(batch->over[i]){
+                tg_batch_reset(batch, i, seed + t * BATCH_GAMES + i);
+            }
+        }
+    }
+    elapsed = now_sec() - start;
+
+    printf("%4dx%-3d %8d %16.0f %10ld\n", rows, cols, nthreads, (double) BATCH_TICKS * BATCH_GAMES / elapsed, lines);
+
+    tg_batch_delete(batch);
+    free(moves);
+    free(cleared);
+}
+
+/* Placement search throughput, in placements scored per ms, with the search playing a 22x10 game (holding too) by
+ * itself for a number of blocks; only the time spent searching is counted.
+ */
+static void bench_search(int depth, int seed, int nthreads){
+    int placed = 0;
+    long evaluated = 0, lines = 0;
+    double start, elapsed = 0;
+    tetris_plan plan;
+    tetris_game *obj = tg_create(22, 10, seed);
+    tetris_search *search = tg_search_create(depth, true, nthreads);
+
+    while(placed < SEARCH_BLOCKS[depth - 1] && !tg_game_over(obj)){
+        start = now_sec();
+        if(!tg_search_plan(search, obj, &plan)){
+            elapsed += now_sec() - start;
+            lines += tg_tick(obj, TM_NONE);
+            continue;
+        }
+        elapsed += now_sec() - start;
+        evaluated += plan.evaluated;
+        lines += tg_tick_moves(obj, plan.moves, plan.n_moves);
+        placed++;
+    }
+
+    // none placed if the game is over from the start, or the search never found a placement
+    printf("%5d %8d %15.0f %12.3f %10ld\n", depth, nthreads, elapsed > 0 ? evaluated / elapsed / 1000 : 0,
+           placed > 0 ? elapsed * 1000 / placed : 0, lines);
+
+    tg_search_delete(search);
+    tg_delete(obj);
+}
+
+int main(int argc, char* argv[]){
+    unsigned int i;
+    int seed = argc > 1 ? atoi(argv[1]) : DEFAULT_SEED;
+    long ticks = argc > 2 ? atol(argv[2]) : DEFAULT_TICKS;
+
+    printf("Throughput (%ld scripted ticks per board, seed %d)\n", ticks, seed);
+    printf("%-8s %14s %16s %10s\n", "board", "ticks/sec", "line-clears/sec", "lines");
+    for(i = 0; i < NUM_BOARD_SIZES; i++){
+        bench_throughput(BOARD_SIZES[i][0], BOARD_SIZES[i][1], seed, ticks);
+    }
+
+    printf("\nPrimitives (ns/call, %d calls each)\n", PRIMITIVE_ITERS);
+    printf("%-8s %10s %13s %10s %10s %10s %10s %15s\n", "board", "tg_fits", "check_lines", "tg_down", "tg_rotate",
+           "tg_save", "tg_load", "check_lines(4)");
+    for(i = 0; i < NUM_BOARD_SIZES; i++){
+        bench_primitives(BOARD_SIZES[i][0], BOARD_SIZES[i][1], seed);
+    }
+
+    int ncpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    printf("\nBatch engine (%d games, %d ticks)\n", BATCH_GAMES, BATCH_TICKS);
+    printf("%-8s %8s %16s %10s\n", "board", "threads", "game-ticks/sec", "lines");
+    for(i = 0; i < NUM_BOARD_SIZES; i++){
+        bench_batch(BOARD_SIZES[i][0], BOARD_SIZES[i][1], seed, 1);
+        if(ncpus > 1){
+            bench_batch(BOARD_SIZES[i][0], BOARD_SIZES[i][1], seed, ncpus);
+        }
+    }
+
+    printf("\nPlacement search (22x10, with hold)\n");
+    printf("%5s %8s %15s %12s %10s\n", "depth", "threads", "placements/ms", "ms/block", "lines");
+    for(i = 1; i <= SEARCH_DEPTHS; i++){
+        bench_search(i, seed, 1);
+        if(ncpus > 1){
+            bench_search(i, seed, ncpus);
+        }
+    }
+
+    return 0;
+}
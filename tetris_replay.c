@@ -0,0 +1,315 @@
+/***************************************************************************//**
+ * Replays: compact, deterministic recordings of tetris games, see
+ * tetris_replay.h for the file format.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "tetris_replay.h"
+
+/*******************************************************************************
+
+                                  Recording
+
+*******************************************************************************/
+
+/*
+  Write out the buffer.
+ */
+static void tr_flush(tetris_recorder *rec)
+{
+  fwrite(rec->buf, 1, rec->len, rec->f);
+  rec->len = 0;
+}
+
+/*
+  Append a varint.
+ */
+static void tr_put_varint(tetris_recorder *rec, unsigned long value)
+{
+  while (value >= 0x80) {
+    rec->buf[rec->len++] = (unsigned char) (value | 0x80);
+    value >>= 7;
+  }
+  rec->buf[rec->len++] = (unsigned char) value;
+}
+
+/*
+  Longest entry: an opcode and two varints of up to 10 bytes each, or the moves
+  of a tick and their count.
+ */
+#define TR_MAX_ENTRY 21
+
+#if TG_MAX_MOVES > TR_MAX_ENTRY - 2
+#error "TR_MAX_ENTRY too small for the moves of a tick"
+#endif
+
+/*
+  Append an opcode, making sure first that there is room for its arguments,
+  which are appended by the caller with tr_put_varint.
+ */
+static void tr_put(tetris_recorder *rec, int op)
+{
+  if (rec->len > TR_BUFFER_SIZE - TR_MAX_ENTRY) {
+    tr_flush(rec);
+  }
+  rec->buf[rec->len++] = (unsigned char) op;
+}
+
+/*
+  Write out the pending run of idle ticks, if any.
+ */
+static void tr_put_idle(tetris_recorder *rec)
+{
+  if (rec->idle > 0) {
+    tr_put(rec, TR_OP_IDLE);
+    tr_put_varint(rec, rec->idle);
+    rec->idle = 0;
+  }
+}
+
+/*
+  Zigzag encoding of a signed value, so that small negative values also make
+  short varints, and its decoding.
+ */
+static unsigned long tr_zigzag(long value)
+{
+  return ((unsigned long) value << 1) ^ (unsigned long) (value < 0 ? -1 : 0);
+}
+
+static long tr_unzigzag(unsigned long value)
+{
+  return (long) (value >> 1) ^ -(long) (value & 1);
+}
+
+/*
+  Start recording a game into the file at path, returning NULL on failure.
+ */
+tetris_recorder *tr_record_open(const char *path, int rows, int cols, int seed)
+{
+  tetris_recorder *rec;
+
+  if (rows < 2 || rows > TR_MAX_ROWS || cols < TG_MIN_COLS ||
+      cols > TG_MAX_COLS) {
+    return NULL;
+  }
+  rec = malloc(sizeof(tetris_recorder));
+  if (rec == NULL) {
+    return NULL;
+  }
+  rec->f = fopen(path, "wb");
+  if (rec->f == NULL) {
+    free(rec);
+    return NULL;
+  }
+  rec->idle = 0;
+
+  memcpy(rec->buf, TR_MAGIC, 4);
+  rec->buf[4] = TR_VERSION;
+  rec->len = 5;
+  tr_put_varint(rec, rows);
+  tr_put_varint(rec, cols);
+  tr_put_varint(rec, tr_zigzag(seed));
+  return rec;
+}
+
+/*
+  Record a tick, with the move given to tg_tick.
+ */
+void tr_record_tick(tetris_recorder *rec, tetris_move move)
+{
+  if (move == TM_NONE) {
+    rec->idle++;
+  } else {
+    tr_put_idle(rec);
+    tr_put(rec, move);
+  }
+}
+
+/*
+  Record a tick with the moves given to tg_tick_moves; ticks with no move, or a
+  single one, are recorded as by tr_record_tick.
+ */
+void tr_record_moves(tetris_recorder *rec, const tetris_move *moves, int n)
+{
+  int i;
+
+  if (n > TG_MAX_MOVES) {
+    n = TG_MAX_MOVES; // as tg_tick_moves
+  }
+  if (n <= 1) {
+    tr_record_tick(rec, n == 1 ? moves[0] : TM_NONE);
+    return;
+  }
+  tr_put_idle(rec);
+  tr_put(rec, TR_OP_MOVES);
+  tr_put_varint(rec, n);
+  for (i = 0; i < n; i++) {
+    rec->buf[rec->len++] = (unsigned char) moves[i];
+  }
+}
+
+/*
+  Record n lines added through tg_add_lines, after the last recorded tick.
+ */
+void tr_record_lines(tetris_recorder *rec, int n)
+{
+  tr_put_idle(rec);
+  tr_put(rec, TR_OP_LINES);
+  tr_put_varint(rec, n);
+}
+
+/*
+  Record n garbage lines queued through tg_queue_garbage, after the last
+  recorded tick.
+ */
+void tr_record_garbage(tetris_recorder *rec, int n, int hole)
+{
+  tr_put_idle(rec);
+  tr_put(rec, TR_OP_GARBAGE);
+  tr_put_varint(rec, n);
+  tr_put_varint(rec, tr_zigzag(hole));
+}
+
+/*
+  End the recording, returning 0 on success or EOF if writing failed.
+ */
+int tr_record_close(tetris_recorder *rec)
+{
+  int ret;
+
+  tr_put_idle(rec);
+  tr_put(rec, TR_OP_END);
+  tr_flush(rec);
+  ret = ferror(rec->f) ? EOF : 0;
+  if (fclose(rec->f) != 0) {
+    ret = EOF;
+  }
+  free(rec);
+  return ret;
+}
+
+/*******************************************************************************
+
+                                  Playback
+
+*******************************************************************************/
+
+/*
+  Read a varint, returning false on end of file.
+ */
+static bool tr_get_varint(FILE *f, unsigned long *value)
+{
+  int c, shift = 0;
+
+  *value = 0;
+  do {
+    if ((c = getc(f)) == EOF || shift >= 64) {
+      return false;
+    }
+    *value |= (unsigned long) (c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return true;
+}
+
+/*
+  Wait for the next tick when playing back at real time.
+ */
+static void tr_wait(struct timespec *deadline, long long tick_nsec)
+{
+  long long nsec = deadline->tv_nsec + tick_nsec;
+
+  deadline->tv_sec += nsec / 1000000000LL;
+  deadline->tv_nsec = nsec % 1000000000LL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) ==
+         EINTR);
+}
+
+tetris_game *tr_play(FILE *f, long long tick_nsec, tetris_replay_info *info)
+{
+  char magic[4];
+  int c, i, version;
+  unsigned long rows, cols, zseed, n, zhole;
+  tetris_move moves[TG_MAX_MOVES];
+  tetris_replay_info summary = {0};
+  struct timespec deadline;
+  tetris_game *obj;
+
+  if (fread(magic, 1, 4, f) != 4 || memcmp(magic, TR_MAGIC, 4) != 0 ||
+      (version = getc(f)) < TR_MIN_VERSION || version > TR_VERSION ||
+      !tr_get_varint(f, &rows) || !tr_get_varint(f, &cols) ||
+      !tr_get_varint(f, &zseed) || rows < 2 || rows > TR_MAX_ROWS ||
+      cols < TG_MIN_COLS || cols > TG_MAX_COLS) {
+    return NULL;
+  }
+
+  summary.rows = (int) rows;
+  summary.cols = (int) cols;
+  summary.seed = (int) tr_unzigzag(zseed);
+  obj = tg_create(summary.rows, summary.cols, summary.seed);
+  if (obj == NULL) {
+    return NULL;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  while ((c = getc(f)) != EOF) {
+    if (c < TM_NONE) {
+      n = 1;
+    } else if (c == TR_OP_IDLE) {
+      if (!tr_get_varint(f, &n)) {
+        break;
+      }
+    } else if (c == TR_OP_LINES) {
+      if (!tr_get_varint(f, &n) || n > rows) {
+        break;
+      }
+      tg_add_lines(obj, (int) n);
+      continue;
+    } else if (c == TR_OP_GARBAGE) {
+      if (!tr_get_varint(f, &n) || !tr_get_varint(f, &zhole) || n > rows ||
+          tr_unzigzag(zhole) < TG_GARBAGE_RANDOM ||
+          tr_unzigzag(zhole) >= (long) cols) {
+        break;
+      }
+      tg_queue_garbage(obj, (int) n, (int) tr_unzigzag(zhole));
+      continue;
+    } else if (c == TR_OP_MOVES) {
+      if (!tr_get_varint(f, &n) || n > TG_MAX_MOVES) {
+        break;
+      }
+      for (i = 0; i < (int) n && (c = getc(f)) != EOF && c <= TM_NONE; i++) {
+        moves[i] = (tetris_move) c;
+      }
+      if (i < (int) n) {
+        break;
+      }
+      if (tick_nsec > 0) {
+        tr_wait(&deadline, tick_nsec);
+      }
+      summary.lines_cleared += tg_tick_moves(obj, moves, i);
+      summary.ticks++;
+      continue;
+    } else {
+      summary.complete = c == TR_OP_END;
+      break;
+    }
+
+    for (; n > 0; n--) {
+      if (tick_nsec > 0) {
+        tr_wait(&deadline, tick_nsec);
+      }
+      summary.lines_cleared += tg_tick(obj, c < TM_NONE ? (tetris_move) c
+                                                         : TM_NONE);
+      summary.ticks++;
+    }
+  }
+
+  if (info) {
+    *info = summary;
+  }
+  return obj;
+}
@@ -0,0 +1,94 @@
+/***************************************************************************//**
+ * Replays: compact, deterministic recordings of tetris games.
+ *
+ * A game is fully determined by its board size, its seed and the stream of
+ * inputs to the engine, i.e. the moves given to each tick and any lines added
+ * through tg_add_lines.  A replay is that and nothing more, so that recording
+ * costs a few bytes per move rather than a board dump per frame.
+ *
+ * File format: the magic "TGRP", a version byte, then the varints rows, cols
+ * and the zigzag-encoded seed.  These are followed by a stream of opcodes:
+ *   TM_LEFT .. TM_HOLD  one tick, with that move
+ *   TR_OP_MOVES n m...  one tick, with the n moves m, one byte each, given to
+ *                       tg_tick_moves
+ *   TR_OP_IDLE n        n ticks with TM_NONE (runs of idle ticks, which make up
+ *                       most of a game, are run length encoded)
+ *   TR_OP_LINES n       tg_add_lines(obj, n), after the last tick
+ *   TR_OP_GARBAGE n h   tg_queue_garbage(obj, n, h), after the last tick, with
+ *                       h zigzag-encoded
+ *   TR_OP_END           end of the game
+ * All varints are unsigned LEB128.  Version 1 replays, from before the garbage
+ * rules changed, are no longer played back; version 2 replays, from before
+ * TR_OP_MOVES was added, still are.
+ ******************************************************************************/
+
+#ifndef TETRIS_REPLAY_H
+#define TETRIS_REPLAY_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "tetris.h"
+
+#define TR_MAGIC "TGRP"
+#define TR_VERSION 3
+#define TR_MIN_VERSION 2
+
+/*
+  Tallest board recorded or played back, far above any board played, so that
+  replays of taller boards are rejected rather than allocated blindly.
+ */
+#define TR_MAX_ROWS 4096
+
+/*
+  Opcodes, besides the moves TM_LEFT to TM_HOLD.
+ */
+#define TR_OP_IDLE TM_NONE
+#define TR_OP_LINES (TM_NONE + 1)
+#define TR_OP_END (TM_NONE + 2)
+#define TR_OP_GARBAGE (TM_NONE + 3)
+#define TR_OP_MOVES (TM_NONE + 4)
+
+#define TR_BUFFER_SIZE 4096
+
+/*
+  A replay being recorded.  Output is buffered, and written out only when the
+  buffer fills up or the recording is closed.
+ */
+typedef struct {
+  FILE *f;
+  long idle;  // ticks of TM_NONE not yet written out
+  size_t len;
+  unsigned char buf[TR_BUFFER_SIZE];
+} tetris_recorder;
+
+/*
+  Summary of a played back replay.
+ */
+typedef struct {
+  int rows;
+  int cols;
+  int seed;
+  long ticks;
+  long lines_cleared;
+  bool complete;  // whether the replay ended with TR_OP_END
+} tetris_replay_info;
+
+// Recording.  Boards of fewer than 2 or more than TR_MAX_ROWS rows, or outside
+// TG_MIN_COLS to TG_MAX_COLS columns, are not recorded (NULL is returned).
+tetris_recorder *tr_record_open(const char *path, int rows, int cols, int seed);
+void tr_record_tick(tetris_recorder *rec, tetris_move move);
+void tr_record_moves(tetris_recorder *rec, const tetris_move *moves, int n);
+void tr_record_lines(tetris_recorder *rec, int n);
+void tr_record_garbage(tetris_recorder *rec, int n, int hole);
+int tr_record_close(tetris_recorder *rec);
+
+/*
+  Play back a replay headless, returning the game in its final state (to be
+  freed with tg_delete), or NULL if f is not a replay or out of memory.  Ticks
+  are run every tick_nsec nanoseconds, or as fast as possible if tick_nsec is 0.
+  If info is not NULL it is filled in.
+ */
+tetris_game *tr_play(FILE *f, long long tick_nsec, tetris_replay_info *info);
+
+#endif // TETRIS_REPLAY_H
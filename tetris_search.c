@@ -0,0 +1,753 @@
+/***************************************************************************//**
+ * Placement search: an autoplayer on top of the tetris engine, see
+ * tetris_search.h.
+ *
+ * Placements are found by playing the engine's own moves on the row bitmasks:
+ * every number of rotations (kicks included, as tg_rotate does) followed by
+ * every run of shifts in either direction, each dropped where it lands; those
+ * landing on the same cells are counted once.  The placements of the falling
+ * block, and of the block swapped in by a hold, are the tasks of a search.
+ *
+ * Each worker thread starts with a contiguous range of the tasks in its own
+ * deque, taking tasks from the back of it, and once it is empty, steals them
+ * from the front of the others'; no task is added once a search starts, hence
+ * a worker finding every deque empty is done.  A worker keeps one board per
+ * ply: the last block is placed into its board and taken back out once
+ * scored, unless it clears lines, while earlier blocks are placed into a copy.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "tetris_search.h"
+
+#define MAX(X,Y) ((X) > (Y) ? (X) : (Y))
+#define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
+
+/*
+  Most placements of a block: one per orientation and column.
+ */
+#define TG_SEARCH_MAX_PLACEMENTS (NUM_ORIENTATIONS * TG_MAX_COLS)
+
+const tetris_weights TG_SEARCH_WEIGHTS = {
+  -0.510066, // height
+  0.760666,  // lines
+  -0.35663,  // holes
+  -0.184483  // bumpiness
+};
+
+/*
+  Where a block lands, and how it gets there from where it starts: rotated
+  rotation times clockwise (-1 for once counter-clockwise), then shifted by
+  shift columns, negative to the left.
+ */
+typedef struct {
+  tetris_block block;
+  signed char rotation;
+  signed char shift;
+} tetris_placement;
+
+/*
+  A placement of the falling block, or of the block swapped in by a hold, and
+  the type of the block placed after it, or -1 if not known yet.
+ */
+typedef struct {
+  tetris_placement placement;
+  bool hold;
+  int following;
+} tetris_search_task;
+
+/*
+  The tasks [head, tail) of a worker.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  int head;
+  int tail;
+} tetris_search_deque;
+
+/*
+  The worker threads of a search.  Worker 0 is the caller of tg_search_plan;
+  workers 1 to nthreads-1 wait for a new generation to be published, work
+  through the tasks and report back.  Each has TG_SEARCH_MAX_DEPTH + 1 boards,
+  and the type of the block placed at each ply, -1 if not known.
+ */
+typedef struct {
+  tetris_search_pool *pool;
+  int id;
+  tetris_row *boards;
+  int pieces[TG_SEARCH_MAX_DEPTH];
+  long evaluated;
+} tetris_search_worker;
+
+struct tetris_search_pool {
+  int nthreads;
+  pthread_t *threads;
+  tetris_search_worker *workers;
+  tetris_search_deque *deques;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned long generation;
+  int pending;
+  bool quit;
+  /*
+    The search being run, and how many workers take part in it.
+   */
+  tetris_search *search;
+  tetris_game *game;
+  int depth;
+  int active;
+  /*
+    Its tasks and their scores.
+   */
+  tetris_search_task tasks[2 * TG_SEARCH_MAX_PLACEMENTS];
+  double scores[2 * TG_SEARCH_MAX_PLACEMENTS];
+  int n_tasks;
+  /*
+    Rows each board of the workers has room for.
+   */
+  int capacity;
+};
+
+/*******************************************************************************
+
+                                Board Helpers
+
+*******************************************************************************/
+
+/*
+  Rotate a block in either direction (+/-1), as tg_rotate does.
+ */
+static tetris_block tg_search_rotate(const tetris_row *rowbits, int rows,
+                                     int cols, tetris_block block,
+                                     int direction)
+{
+  int i;
+
+  for (i = 0; i < NUM_ORIENTATIONS; i++) {
+    block.ori = (block.ori + direction + NUM_ORIENTATIONS) % NUM_ORIENTATIONS;
+    if (tb_fits(rowbits, rows, cols, block))
+      break;
+    block.loc.col--;
+    if (tb_fits(rowbits, rows, cols, block))
+      break;
+    block.loc.col += 2;
+    if (tb_fits(rowbits, rows, cols, block))
+      break;
+    block.loc.col--;
+  }
+  return block;
+}
+
+/*
+  Return the topmost row holding a filled cell, or rows if there is none.
+ */
+static int tg_search_top(const tetris_row *rowbits, int rows)
+{
+  int r = 0;
+
+  while (r < rows && rowbits[r] == 0) {
+    r++;
+  }
+  return r;
+}
+
+/*
+  Move a block down as far as it goes.  Rows above top are empty, so a block
+  lying above it falls straight to just above it.
+ */
+static tetris_block tg_search_drop(const tetris_row *rowbits, int rows,
+                                   int cols, tetris_block block, int top)
+{
+  const tetris_shape *shape = &TETROMINO_SHAPES[block.typ][block.ori];
+
+  block.loc.row = MAX(block.loc.row, top - 1 - shape->bottom);
+  do {
+    block.loc.row++;
+  } while (tb_fits(rowbits, rows, cols, block));
+  block.loc.row--;
+  return block;
+}
+
+/*
+  Identify a block by the cells it covers, whatever its orientation.
+ */
+static uint64_t tg_search_key(tetris_block block)
+{
+  const tetris_shape *shape = &TETROMINO_SHAPES[block.typ][block.ori];
+  uint64_t cells = shape->rows[0] | shape->rows[1] << 8 | shape->rows[2] << 16 |
+                   (uint64_t) shape->rows[3] << 24;
+
+  return cells << 32 | (uint64_t) (block.loc.row + shape->top) << 16 |
+         (uint64_t) (block.loc.col + shape->left);
+}
+
+/*
+  Store into out the placements of a block, from where it is, taking at most
+  budget moves besides the drop, and return how many there are.
+ */
+static int tg_search_placements(const tetris_row *rowbits, int rows, int cols,
+                                tetris_block start, int budget,
+                                tetris_placement *out)
+{
+  // cheapest first, so that placements reached either way keep the fewest moves
+  static const signed char rotations[NUM_ORIENTATIONS] = {0, 1, -1, 2};
+  uint64_t keys[TG_SEARCH_MAX_PLACEMENTS], key;
+  int i, k, r, s, cost, direction, n = 0, top = tg_search_top(rowbits, rows);
+  tetris_block rotated, shifted, landed;
+
+  for (r = 0; r < NUM_ORIENTATIONS; r++) {
+    cost = abs(rotations[r]);
+    rotated = start;
+    for (i = 0; i < cost; i++) {
+      rotated = tg_search_rotate(rowbits, rows, cols, rotated,
+                                 rotations[r] > 0 ? 1 : -1);
+    }
+    for (direction = -1; direction <= 1; direction += 2) {
+      for (s = direction < 0 ? 0 : 1; cost + s <= budget; s++) {
+        shifted = rotated;
+        shifted.loc.col += direction * s;
+        if (!tb_fits(rowbits, rows, cols, shifted)) {
+          break; // as tg_move refuses to shift it there, nor any further
+        }
+        landed = tg_search_drop(rowbits, rows, cols, shifted, top);
+        key = tg_search_key(landed);
+        for (k = 0; k < n && keys[k] != key; k++);
+        if (k < n) {
+          continue;
+        }
+        keys[n] = key;
+        out[n].block = landed;
+        out[n].rotation = rotations[r];
+        out[n].shift = direction * s;
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+/*
+  Toggle the cells of a block: place it where it fits, or take it back out.
+ */
+static void tg_search_toggle(tetris_row *rowbits, tetris_block block)
+{
+  const tetris_shape *shape = &TETROMINO_SHAPES[block.typ][block.ori];
+  int i, top = block.loc.row + shape->top, left = block.loc.col + shape->left;
+
+  for (i = 0; i <= shape->bottom - shape->top; i++) {
+    rowbits[top + i] ^= (tetris_row) shape->rows[i] << left;
+  }
+}
+
+/*
+  Whether any of rows top to bottom is full.
+ */
+static bool tg_search_full(const tetris_row *rowbits, tetris_row full_row,
+                           int top, int bottom)
+{
+  int r;
+
+  for (r = top; r <= bottom; r++) {
+    if (rowbits[r] == full_row) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+  Remove the full rows among rows top to bottom, as tb_clear_lines does for the
+  row bitmasks alone, and return how many were removed.
+ */
+static int tg_search_clear(tetris_row *rowbits, tetris_row full_row, int top,
+                           int bottom)
+{
+  int src, dst = bottom, nlines = 0;
+
+  for (src = bottom; src >= top; src--) {
+    if (rowbits[src] == full_row) {
+      nlines++;
+    } else {
+      rowbits[dst--] = rowbits[src];
+    }
+  }
+
+  if (nlines > 0) {
+    memmove(rowbits + nlines, rowbits, top * sizeof(tetris_row));
+    memset(rowbits, 0, nlines * sizeof(tetris_row));
+  }
+  return nlines;
+}
+
+/*
+  Score a board, on which lines were cleared so far.  A column's height counts
+  from the bottom of the board up to its topmost filled cell; the cells under
+  it which are empty are holes.
+ */
+static double tg_search_evaluate(const tetris_weights *weights,
+                                 const tetris_row *rowbits, int rows, int cols,
+                                 int lines)
+{
+  int heights[TG_MAX_COLS];
+  int r, c, height = 0, holes = 0, bumpiness = 0;
+  tetris_row seen = 0, found, covered;
+
+  for (c = 0; c < cols; c++) {
+    heights[c] = 0;
+  }
+  for (r = tg_search_top(rowbits, rows); r < rows; r++) {
+    for (found = rowbits[r] & ~seen; found != 0; found &= found - 1) {
+      heights[__builtin_ctzll(found)] = rows - r;
+      height += rows - r;
+    }
+    covered = seen & ~rowbits[r];
+    if (covered != 0) {
+      holes += __builtin_popcountll(covered);
+    }
+    seen |= rowbits[r];
+  }
+  for (c = 0; c < cols - 1; c++) {
+    bumpiness += abs(heights[c] - heights[c + 1]);
+  }
+
+  return weights->height * height + weights->lines * lines +
+         weights->holes * holes + weights->bumpiness * bumpiness;
+}
+
+/*******************************************************************************
+
+                                  Lookahead
+
+*******************************************************************************/
+
+static double tg_search_place(tetris_search_worker *worker, int ply,
+                              tetris_block block, int lines);
+
+/*
+  Return the best score of a block of the given type, brought in on the board
+  of the given ply.
+ */
+static double tg_search_best(tetris_search_worker *worker, int ply, int typ,
+                             int lines)
+{
+  tetris_placement placements[TG_SEARCH_MAX_PLACEMENTS];
+  tetris_game *game = worker->pool->game;
+  tetris_row *board = worker->boards + ply * game->rows;
+  tetris_block block = {typ, 0, {0, game->cols/2 - 2}};
+  double score, best = TG_SEARCH_LOSS;
+  int i, n;
+
+  if (!tb_fits(board, game->rows, game->cols, block)) {
+    return TG_SEARCH_LOSS;
+  }
+  n = tg_search_placements(board, game->rows, game->cols, block,
+                           TG_MAX_MOVES - 1, placements);
+  for (i = 0; i < n; i++) {
+    score = tg_search_place(worker, ply, placements[i].block, lines);
+    best = MAX(best, score);
+  }
+  return best;
+}
+
+/*
+  Return the score of a block landed on the board of the given ply, with lines
+  cleared so far: that of the board it leaves if it is the last block placed,
+  otherwise the best score of the next block, or the mean over every type of
+  block if the next one is not known.
+ */
+static double tg_search_place(tetris_search_worker *worker, int ply,
+                              tetris_block block, int lines)
+{
+  tetris_search_pool *pool = worker->pool;
+  tetris_game *game = pool->game;
+  int t, rows = game->rows, top = game->rows, bottom = -1;
+  tetris_row *board = worker->boards + ply * rows, *after = board + rows;
+  bool last = ply + 1 == pool->depth;
+  double score;
+
+  worker->evaluated++;
+  tb_block_rows(block, &top, &bottom);
+  tg_search_toggle(board, block);
+
+  if (last && !tg_search_full(board, game->full_row, top, bottom)) {
+    score = board[0] | board[1] ? TG_SEARCH_LOSS
+          : tg_search_evaluate(&pool->search->weights, board, rows, game->cols,
+                               lines);
+    tg_search_toggle(board, block);
+    return score;
+  }
+
+  memcpy(after, board, rows * sizeof(tetris_row));
+  tg_search_toggle(board, block);
+  lines += tg_search_clear(after, game->full_row, top, bottom);
+  if (after[0] | after[1]) {
+    return TG_SEARCH_LOSS;
+  }
+  if (last) {
+    return tg_search_evaluate(&pool->search->weights, after, rows, game->cols,
+                              lines);
+  }
+
+  if (worker->pieces[ply + 1] >= 0) {
+    return tg_search_best(worker, ply + 1, worker->pieces[ply + 1], lines);
+  }
+  score = 0;
+  for (t = 0; t < NUM_TETROMINOS; t++) {
+    score += tg_search_best(worker, ply + 1, t, lines);
+  }
+  return score / NUM_TETROMINOS;
+}
+
+/*******************************************************************************
+
+                                Worker Threads
+
+*******************************************************************************/
+
+/*
+  Take a task for a worker: from the back of its own deque, or else from the
+  front of another's, starting with the next one.  Returns -1 once none is left.
+ */
+static int tg_search_take(tetris_search_worker *worker)
+{
+  tetris_search_pool *pool = worker->pool;
+  tetris_search_deque *deque = &pool->deques[worker->id];
+  int i, task = -1;
+
+  pthread_mutex_lock(&deque->lock);
+  if (deque->head < deque->tail) {
+    task = --deque->tail;
+  }
+  pthread_mutex_unlock(&deque->lock);
+
+  for (i = 1; task < 0 && i < pool->active; i++) {
+    deque = &pool->deques[(worker->id + i) % pool->active];
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+      task = deque->head++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+  }
+  return task;
+}
+
+static void tg_search_work(tetris_search_worker *worker)
+{
+  tetris_search_pool *pool = worker->pool;
+  int i, task;
+
+  worker->evaluated = 0;
+  if (worker->id >= pool->active) {
+    return;
+  }
+  memcpy(worker->boards, pool->game->rowbits,
+         pool->game->rows * sizeof(tetris_row));
+  for (i = 0; i < TG_SEARCH_MAX_DEPTH; i++) {
+    worker->pieces[i] = -1;
+  }
+
+  while ((task = tg_search_take(worker)) >= 0) {
+    worker->pieces[1] = pool->tasks[task].following;
+    pool->scores[task] = tg_search_place(worker, 0,
+                                         pool->tasks[task].placement.block, 0);
+  }
+}
+
+static void *tg_search_worker_main(void *arg)
+{
+  tetris_search_worker *worker = arg;
+  tetris_search_pool *pool = worker->pool;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->quit && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->quit) {
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    tg_search_work(worker);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/*
+  Make sure the boards of every worker have room for the given number of rows;
+  called while the workers are idle.
+ */
+static bool tg_search_reserve(tetris_search_pool *pool, int rows)
+{
+  int t;
+  tetris_row *boards;
+
+  if (rows <= pool->capacity) {
+    return true;
+  }
+  for (t = 0; t < pool->nthreads; t++) {
+    boards = malloc((size_t) (TG_SEARCH_MAX_DEPTH + 1) * rows *
+                    sizeof(tetris_row));
+    if (boards == NULL) {
+      return false;
+    }
+    free(pool->workers[t].boards);
+    pool->workers[t].boards = boards;
+  }
+  pool->capacity = rows;
+  return true;
+}
+
+static void tg_search_pool_delete(tetris_search_pool *pool, int started)
+{
+  int t;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (t = 0; t < started; t++) {
+    pthread_join(pool->threads[t], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  if (pool->workers) {
+    for (t = 0; t < pool->nthreads; t++) {
+      free(pool->workers[t].boards);
+    }
+  }
+  if (pool->deques) {
+    for (t = 0; t < pool->nthreads; t++) {
+      pthread_mutex_destroy(&pool->deques[t].lock);
+    }
+  }
+  free(pool->threads);
+  free(pool->workers);
+  free(pool->deques);
+  free(pool);
+}
+
+static tetris_search_pool *tg_search_pool_create(tetris_search *search,
+                                                 int nthreads)
+{
+  int t;
+  tetris_search_pool *pool = calloc(1, sizeof(tetris_search_pool));
+
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->nthreads = nthreads;
+  pool->search = search;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->threads = calloc(nthreads, sizeof(pthread_t));
+  pool->workers = calloc(nthreads, sizeof(tetris_search_worker));
+  pool->deques = calloc(nthreads, sizeof(tetris_search_deque));
+  if (!pool->threads || !pool->workers || !pool->deques) {
+    free(pool->deques);
+    pool->deques = NULL;
+    tg_search_pool_delete(pool, 0);
+    return NULL;
+  }
+  for (t = 0; t < nthreads; t++) {
+    pthread_mutex_init(&pool->deques[t].lock, NULL);
+    pool->workers[t].pool = pool;
+    pool->workers[t].id = t;
+  }
+
+  for (t = 1; t < nthreads; t++) {
+    if (pthread_create(&pool->threads[t-1], NULL, tg_search_worker_main,
+                       &pool->workers[t]) != 0) {
+      tg_search_pool_delete(pool, t-1);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+/*******************************************************************************
+
+                                  Searching
+
+*******************************************************************************/
+
+tetris_search *tg_search_create(int depth, bool hold, int nthreads)
+{
+  tetris_search *search = calloc(1, sizeof(tetris_search));
+
+  if (search == NULL) {
+    return NULL;
+  }
+
+  if (nthreads <= 0) {
+    nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  nthreads = MAX(nthreads, 1);
+
+  search->weights = TG_SEARCH_WEIGHTS;
+  search->depth = depth;
+  search->hold = hold;
+  if (!(search->pool = tg_search_pool_create(search, nthreads))) {
+    free(search);
+    return NULL;
+  }
+  return search;
+}
+
+void tg_search_delete(tetris_search *search)
+{
+  tg_search_pool_delete(search->pool, search->pool->nthreads - 1);
+  free(search);
+}
+
+/*
+  Add the placements of a block, starting where it is, as tasks.
+ */
+static void tg_search_add_tasks(tetris_search_pool *pool, tetris_block block,
+                                bool hold, int following)
+{
+  tetris_placement placements[TG_SEARCH_MAX_PLACEMENTS];
+  tetris_game *game = pool->game;
+  int i, n;
+
+  n = tg_search_placements(game->rowbits, game->rows, game->cols, block,
+                           TG_MAX_MOVES - 1 - hold, placements);
+  for (i = 0; i < n; i++) {
+    pool->tasks[pool->n_tasks].placement = placements[i];
+    pool->tasks[pool->n_tasks].hold = hold;
+    pool->tasks[pool->n_tasks].following = following;
+    pool->n_tasks++;
+  }
+}
+
+/*
+  Spell out the moves of a task into a plan.
+ */
+static void tg_search_moves(const tetris_search_task *task, tetris_plan *plan)
+{
+  const tetris_placement *placement = &task->placement;
+  int i;
+
+  plan->n_moves = 0;
+  if (task->hold) {
+    plan->moves[plan->n_moves++] = TM_HOLD;
+  }
+  for (i = 0; i < abs(placement->rotation); i++) {
+    plan->moves[plan->n_moves++] = placement->rotation > 0 ? TM_CLOCK
+                                                           : TM_COUNTER;
+  }
+  for (i = 0; i < abs(placement->shift); i++) {
+    plan->moves[plan->n_moves++] = placement->shift > 0 ? TM_RIGHT : TM_LEFT;
+  }
+  plan->moves[plan->n_moves++] = TM_DROP;
+  plan->target = placement->block;
+  plan->hold = task->hold;
+}
+
+bool tg_search_plan(tetris_search *search, tetris_game *obj, tetris_plan *plan)
+{
+  tetris_search_pool *pool = search->pool;
+  tetris_block falling = obj->falling, held;
+  int i, t, best, top = obj->rows, bottom = -1;
+
+  memset(plan, 0, sizeof(tetris_plan));
+  plan->score = TG_SEARCH_LOSS;
+  if (tg_game_over(obj) || !tg_search_reserve(pool, obj->rows)) {
+    return false;
+  }
+
+  // the next tick moves the block down first, if gravity is due
+  if (obj->ticks_till_gravity <= 1) {
+    falling.loc.row++;
+    if (!tb_fits(obj->rowbits, obj->rows, obj->cols, falling)) {
+      return false;
+    }
+  }
+
+  pool->game = obj;
+  pool->depth = MAX(1, MIN(search->depth, TG_SEARCH_MAX_DEPTH));
+  pool->n_tasks = 0;
+  tg_search_add_tasks(pool, falling, false, obj->next.typ);
+
+  // as tg_hold: either the next block is brought in, and the one after it is
+  // not known yet, or the stored one is swapped in where the falling one is,
+  // moved up until it fits
+  if (search->hold) {
+    if (obj->stored.typ == -1) {
+      held = obj->next;
+    } else {
+      held = falling;
+      held.typ = obj->stored.typ;
+      held.ori = obj->stored.ori;
+      tb_block_rows(held, &top, &bottom);
+      while (top > 0 && !tb_fits(obj->rowbits, obj->rows, obj->cols, held)) {
+        held.loc.row--;
+        top--;
+      }
+    }
+    if (tb_fits(obj->rowbits, obj->rows, obj->cols, held)) {
+      tg_search_add_tasks(pool, held, true,
+                          obj->stored.typ == -1 ? -1 : obj->next.typ);
+    }
+  }
+
+  // a single ply is over long before threads would be woken up
+  pool->active = pool->depth > 1 ? MIN(pool->nthreads, pool->n_tasks) : 1;
+  for (t = 0; t < pool->nthreads; t++) {
+    pool->deques[t].head = t < pool->active ?
+        (int) ((long) pool->n_tasks * t / pool->active) : 0;
+    pool->deques[t].tail = t < pool->active ?
+        (int) ((long) pool->n_tasks * (t + 1) / pool->active) : 0;
+  }
+
+  if (pool->active > 1) {
+    pthread_mutex_lock(&pool->lock);
+    pool->pending = pool->nthreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  tg_search_work(&pool->workers[0]);
+
+  if (pool->active > 1) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+      pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  // ties go to the first task, so that the outcome does not depend on timing
+  for (i = 0, best = -1; i < pool->n_tasks; i++) {
+    if (best < 0 || pool->scores[i] > pool->scores[best]) {
+      best = i;
+    }
+  }
+  for (t = 0; t < pool->active; t++) {
+    plan->evaluated += pool->workers[t].evaluated;
+  }
+  if (best < 0) {
+    return false;
+  }
+  tg_search_moves(&pool->tasks[best], plan);
+  plan->score = pool->scores[best];
+  return true;
+}
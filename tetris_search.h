@@ -0,0 +1,105 @@
+/***************************************************************************//**
+ * Placement search: an autoplayer on top of the tetris engine.
+ *
+ * Given a tetris_game, finds every placement the falling block can reach with
+ * the moves of a single tick (rotations, shifts and a drop, optionally after a
+ * hold; at most TG_MAX_MOVES, hence not the far sides of very wide boards), and
+ * scores the board each leaves with a weighted sum of its aggregate height,
+ * lines cleared, holes and bumpiness.  Looking further ahead, the next block is
+ * placed likewise on every such board, and beyond the blocks known to the game
+ * the score is averaged over the seven tetrominos.  The best placement
+ * is returned as the moves to give tg_tick_moves, e.g. for bots in load tests
+ * or practice opponents.
+ *
+ * The placements of the falling block are shared out between a pool of worker
+ * threads, each of which steals from the others once it runs out.  Boards are
+ * bare row bitmasks (see tb_fits), a copy per ply of lookahead, so that
+ * scoring a placement costs a few dozen word operations.
+ ******************************************************************************/
+
+#ifndef TETRIS_SEARCH_H
+#define TETRIS_SEARCH_H
+
+#include <stdbool.h>
+
+#include "tetris.h"
+
+/*
+  Most blocks placed in a row by a single search, including the falling one.
+ */
+#define TG_SEARCH_MAX_DEPTH 4
+
+/*
+  Score of a placement which ends the game.
+ */
+#define TG_SEARCH_LOSS (-1e9)
+
+/*
+  Weights of the heuristic scoring a board: the score is the sum of each
+  feature times its weight, the higher the better.
+ */
+typedef struct {
+  double height;    // per row of the sum of the heights of all columns
+  double lines;     // per line cleared by the blocks placed
+  double holes;     // per empty cell with a filled cell above it
+  double bumpiness; // per row of difference in height between adjacent columns
+} tetris_weights;
+
+/*
+  Default weights, tuned for 22x10 boards.
+ */
+extern const tetris_weights TG_SEARCH_WEIGHTS;
+
+typedef struct tetris_search_pool tetris_search_pool;
+
+/*
+  A search, which may be run on any number of games, one at a time.
+ */
+typedef struct {
+  /*
+    The heuristic, how many blocks to place (at least 1, the falling one, and at
+    most TG_SEARCH_MAX_DEPTH), and whether to consider holding the falling
+    block; all may be changed between searches.
+   */
+  tetris_weights weights;
+  int depth;
+  bool hold;
+  /*
+    Worker threads sharing out each search.
+   */
+  tetris_search_pool *pool;
+} tetris_search;
+
+/*
+  The outcome of a search: the moves to give tg_tick_moves on the next tick,
+  ending with a drop, and where they take the falling block before it locks.
+ */
+typedef struct {
+  tetris_move moves[TG_MAX_MOVES];
+  int n_moves;
+  tetris_block target;
+  bool hold;
+  double score;
+  /*
+    How many placements were scored, over every ply.
+   */
+  long evaluated;
+} tetris_plan;
+
+/*
+  Create a search of the given depth, with the default weights, run by nthreads
+  threads (including the caller; one per CPU if nthreads <= 0).  Returns NULL on
+  failure.
+ */
+tetris_search *tg_search_create(int depth, bool hold, int nthreads);
+void tg_search_delete(tetris_search *search);
+
+/*
+  Find the best placement of the falling block of obj, which must not change
+  meanwhile.  Gravity is accounted for, as the next tick applies it before the
+  moves.  Returns false, with no moves, if there is no placement to make: the
+  game is over, or the block locks by gravity on the next tick.
+ */
+bool tg_search_plan(tetris_search *search, tetris_game *obj, tetris_plan *plan);
+
+#endif // TETRIS_SEARCH_H